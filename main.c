@@ -1,5 +1,12 @@
 #include "pass_db.h"
 #include "pass_defines.h"
+#include "pass_watch.h"
+#include "pass_audit.h"
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 
 // Global variables shared across all commands
 
@@ -9,27 +16,81 @@ db_handle_t handle;
 
 // Get pass moved to seperate function for cleaner code in main function
 
-void prompt_pass()
+void prompt_pass_to(FILE *outfile)
 {
     memset(password, 0, MAX_PASS_LENGTH);
-    printf("\nEnter this database's password\n$ ");
+    fprintf(outfile, "\nEnter this database's password\n$ ");
     fgets(password, MAX_PASS_LENGTH, stdin);
+
+    // Discard the rest of a password too long for the buffer so it isn't read as later input
+    if(!strchr(password, '\n'))
+    {
+        int c = getchar();
+        while(c != '\n' && c != EOF)
+        {
+            c = getchar();
+        }
+    }
     password[strlen(password) - 1] = '\0';
 }
 
+void prompt_pass()
+{
+    prompt_pass_to(stdout);
+}
+
+// Parse a duration such as 30s, 15m, 12h, 90d or 4w into seconds
+// Returns -1 if duration isn't valid
+long parse_duration(char *duration)
+{
+    char *end;
+    long amount = strtol(duration, &end, 10);
+
+    // Amounts are capped so any unit can be converted to seconds without overflowing
+    if(end == duration || amount < 0 || amount > LONG_MAX / (60 * 60 * 24 * 7) || strlen(end) != 1)
+    {
+        return -1;
+    }
+
+    switch(*end)
+    {
+        case 's':
+            return amount;
+        case 'm':
+            return amount * 60;
+        case 'h':
+            return amount * 60 * 60;
+        case 'd':
+            return amount * 60 * 60 * 24;
+        case 'w':
+            return amount * 60 * 60 * 24 * 7;
+    }
+    return -1;
+}
+
 void print_help()
 {
     printf("\nUsage:\n");
     printf("    <program> <command> <filename>\n");
-    printf("    <program> <command> <filename> <passwordname>\n\n");
+    printf("    <program> <command> <filename> <passwordname>\n");
+    printf("    <program> put <filename> <blobname> <inputfile>\n");
+    printf("    <program> rotate <filename> --older-than <duration>\n");
+    printf("    <program> audit <filename> [--max-age <duration>]\n\n");
 
     printf("Commands:\n");
     printf("    create : Create a new password database\n");
     printf("    add    : Add a new password to the database\n");
     printf("    remove : Remove a password from the database\n");
     printf("    get    : Get a password from the database\n");
+    printf("    put    : Add a file to the database as a blob\n");
+    printf("    cat    : Write a blob from the database to stdout\n");
     printf("    list   : List all passwords in the database\n");
     printf("    info   : Get info about the database\n");
+    printf("    verify : Check the database for corrupted records\n");
+    printf("    batch  : Run commands from stdin or a file (get, add, remove, list, search, commit)\n");
+    printf("    rotate : Regenerate all passwords older than a duration (s, m, h, d or w)\n");
+    printf("    watch  : Print changes made to the database by other programs\n");
+    printf("    audit  : Report password strength and reused, weak and expired passwords (default max age 90d)\n");
     printf("    help   : Print help page\n\n");
     
     printf("Examples:\n");
@@ -37,40 +98,305 @@ void print_help()
     printf("    <program> info password_db\n");
     printf("    <program> add password_db email_password\n");
     printf("    <program> get password_db email_password\n");
+    printf("    <program> put password_db server_cert server.pem\n");
+    printf("    <program> cat password_db server_cert > server.pem\n");
+    printf("    <program> batch password_db commands.txt\n");
+    printf("    <program> rotate password_db --older-than 90d\n");
+    printf("    <program> audit password_db --max-age 180d\n");
 }
 
-void handle_errors(int error_code)
+// Message describing an error code returned by the database functions
+const char * error_message(int error_code)
 {
     switch(error_code)
     {
         case DB_FILE_NOT_FOUND:
-            printf("\nA file with that name could not be found\n\n");
-            break;
+            return "A file with that name could not be found";
         case DB_BAD_FILE_SIZE:
-            printf("\nThis file is not a valid password database\n\n");
-            break;
+            return "This file is not a valid password database";
         case DB_BAD_MAGIC:
-            printf("\nThis file is not a valid password database or your password is incorrect\n\n");
-            break;
+            return "This file is not a valid password database or your password is incorrect";
         case DB_FILE_OPEN_ERROR:
-            printf("\nAn error occured when opening the database\n\n");
-            break;
+            return "An error occured when opening the database";
         case DB_FILE_EXISTS:
-            printf("\nA file with that name already exists\n\n");
-            break;
+            return "A file with that name already exists";
         case DB_RECORD_EXISTS:
-            printf("\nThis database already has a record with that name\n\n");
-            break;
+            return "This database already has a record with that name";
         case DB_RECORD_NOT_FOUND:
-            printf("\nA record with that name could not be found\n\n");
-            break;
+            return "A record with that name could not be found";
         case DB_RECORD_LIMIT_REACHED:
-            printf("\nThis database has reached its maximum capacity (1000 records)\n\n");
-            break;
+            return "This database has reached its maximum capacity (1000 records)";
         case DB_NO_RECORDS:
-            printf("\nThis database has no records in it\n\n");
+            return "This database has no records in it";
+        case DB_VERIFY_FAILED:
+            return "This database failed verification";
+        case DB_RECORD_WRONG_TYPE:
+            return "That command can't be used on this type of record (use 'get' for passwords and 'cat' for blobs)";
+        case DB_BLOB_IO_ERROR:
+            return "An error occured when reading or writing blob data";
+        case DB_BAD_HEADER:
+            return "This database's headers are corrupted";
+        case DB_BAD_RECORD_NAME:
+            return "Record names must be between 1 and 255 characters long";
+        case DB_AUDIT_FAILED:
+            return "This database has reused, weak or expired passwords";
+        case DB_WATCH_ERROR:
+            return "An error occured when watching the database for changes";
+        case DB_BAD_COMMAND:
+            return "Invalid command";
+        case DB_LINE_TOO_LONG:
+            return "Batch lines can't be over 1023 characters long";
+        case DB_BAD_PASS_LENGTH:
+            return "Password length must be between 1 and 10000 characters";
+    }
+    return "An unknown error occured";
+}
+
+void handle_errors_to(FILE *outfile, int error_code)
+{
+    fprintf(outfile, "\n%s\n\n", error_message(error_code));
+}
+
+void handle_errors(int error_code)
+{
+    handle_errors_to(stdout, error_code);
+}
+
+// Print changes found while watching a database
+void print_watch_event(watch_event_t *event, db_handle_t *handle, void *arg)
+{
+    (void) handle;
+    (void) arg;
+
+    switch(event->type)
+    {
+        case WATCH_RECORD_ADDED:
+            printf("Added: %s\n", event->header->name);
+            break;
+        case WATCH_RECORD_REMOVED:
+            printf("Removed: %s\n", event->header->name);
+            break;
+        case WATCH_RECORD_CHANGED:
+            printf("Changed: %s\n", event->header->name);
+            break;
+        case WATCH_DB_ERROR:
+            printf("Error: %s\n", error_message(event->error_code));
             break;
     }
+    fflush(stdout);
+}
+
+// Print a string as a quoted JSON string
+void print_json_string(const char *str)
+{
+    putchar('"');
+    for(; *str; str++)
+    {
+        if(*str == '"' || *str == '\\')
+        {
+            printf("\\%c", *str);
+        }
+        else if((unsigned char) *str < ' ')
+        {
+            printf("\\u%04x", (unsigned char) *str);
+        }
+        else
+        {
+            putchar(*str);
+        }
+    }
+    putchar('"');
+}
+
+// Print the start of a batch result line
+// command is printed as null if it is NULL
+void print_batch_result(int line_num, const char *command, int error_code)
+{
+    printf("{\"line\":%d,\"command\":", line_num);
+    if(command)
+    {
+        print_json_string(command);
+    }
+    else
+    {
+        printf("null");
+    }
+    if(error_code)
+    {
+        printf(",\"status\":\"error\",\"error\":");
+        print_json_string(error_message(error_code));
+    }
+    else
+    {
+        printf(",\"status\":\"ok\"");
+    }
+}
+
+// Print records in a batch result, optionally only those whose name contains pattern
+void print_batch_records(db_handle_t *handle, const char *pattern)
+{
+    printf(",\"records\":[");
+    int printed = 0;
+    uint32_t i;
+    for(i = 0; i < handle->num_records; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[i];
+        if(pattern && !strstr(header->name, pattern))
+        {
+            continue;
+        }
+
+        printf("%s{\"name\":", printed ? "," : "");
+        print_json_string(header->name);
+        printf(",\"type\":\"%s\"", header->record_type == RECORD_TYPE_BLOB ? "blob" : "password");
+        printf(",\"length\":%lu,\"created\":%lu}", (unsigned long) header->pass_size, (unsigned long) header->create_time);
+        printed++;
+    }
+    printf("]");
+}
+
+// Check if command is one of the commands batch mode understands
+int is_batch_command(const char *command)
+{
+    const char *commands[] = {"get", "add", "remove", "list", "search", "commit"};
+    unsigned int i;
+    for(i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if(strcmp(command, commands[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Run newline delimited commands from infile against one opened database
+// Mutations are written once at the end, or whenever a 'commit' command is read
+// Results are printed as one JSON object per line
+int run_batch(FILE *infile, db_handle_t *handle)
+{
+    char line[MAX_INPUT_LENGTH];
+    int line_num = 0;
+    int failed = 0;
+    int dirty = 0;
+
+    while(fgets(line, MAX_INPUT_LENGTH, infile))
+    {
+        line_num++;
+
+        // A line that didn't fit is reported as a whole and the rest of it is skipped
+        if(!strchr(line, '\n'))
+        {
+            int c = getc(infile);
+            if(c != '\n' && c != EOF)
+            {
+                while(c != '\n' && c != EOF)
+                {
+                    c = getc(infile);
+                }
+                print_batch_result(line_num, NULL, DB_LINE_TOO_LONG);
+                printf("}\n");
+                fflush(stdout);
+                failed = 1;
+                continue;
+            }
+        }
+
+        char *command = strtok(line, " \t\r\n");
+        if(!command || command[0] == '#')
+        {
+            continue;
+        }
+        char *name = strtok(NULL, " \t\r\n");
+        char *extra = strtok(NULL, " \t\r\n");
+        int error_code = 0;
+
+        if(strcmp(command, "get") == 0 && name && !extra)
+        {
+            int location = find_record(name, handle);
+            char *output = NULL;
+            if(location == -1)
+            {
+                error_code = DB_RECORD_NOT_FOUND;
+            }
+            else if(handle->pass_headers[location].record_type != RECORD_TYPE_PASS)
+            {
+                error_code = DB_RECORD_WRONG_TYPE;
+            }
+            else
+            {
+                output = get_pass(name, handle);
+            }
+            print_batch_result(line_num, command, error_code);
+            if(output)
+            {
+                printf(",\"name\":");
+                print_json_string(name);
+                printf(",\"value\":");
+                print_json_string(output);
+                memset(output, 0, strlen(output));
+                free(output);
+            }
+        }
+        else if(strcmp(command, "add") == 0 && name && extra)
+        {
+            char *end;
+            long pass_size = strtol(extra, &end, 10);
+            if(*end || pass_size < 1 || pass_size > MAX_GEN_PASS_LENGTH || strtok(NULL, " \t\r\n"))
+            {
+                error_code = DB_BAD_PASS_LENGTH;
+            }
+            else
+            {
+                error_code = add_db_record(name, pass_size, handle);
+                dirty |= !error_code;
+            }
+            print_batch_result(line_num, command, error_code);
+        }
+        else if(strcmp(command, "remove") == 0 && name && !extra)
+        {
+            error_code = remove_db_record(name, handle);
+            dirty |= !error_code;
+            print_batch_result(line_num, command, error_code);
+        }
+        else if(strcmp(command, "list") == 0 && !name)
+        {
+            print_batch_result(line_num, command, 0);
+            print_batch_records(handle, NULL);
+        }
+        else if(strcmp(command, "search") == 0 && name && !extra)
+        {
+            print_batch_result(line_num, command, 0);
+            print_batch_records(handle, name);
+        }
+        else if(strcmp(command, "commit") == 0 && !name)
+        {
+            error_code = dirty ? write_handle(handle) : 0;
+            dirty = error_code ? dirty : 0;
+            print_batch_result(line_num, command, error_code);
+        }
+        else
+        {
+            // Unknown command text isn't echoed since it could be anything, even a password
+            error_code = DB_BAD_COMMAND;
+            print_batch_result(line_num, is_batch_command(command) ? command : NULL, error_code);
+        }
+        printf("}\n");
+        fflush(stdout);
+
+        failed |= error_code != 0;
+    }
+
+    // Commit anything left over since the last checkpoint
+    if(dirty)
+    {
+        int error_code = write_handle(handle);
+        print_batch_result(line_num + 1, "commit", error_code);
+        printf("}\n");
+        failed |= error_code != 0;
+    }
+
+    return failed;
 }
 
 int main(int argc, char **argv)
@@ -85,7 +411,7 @@ int main(int argc, char **argv)
     
     // Check for valid amount of arguments
 
-    if(argc > 4 || argc < 3)
+    if(argc > 5 || argc < 3)
     {
         printf("\nError: Invalid command\nType '<program> help' to get list of commands and proper usage\n\n");
         return 1;
@@ -131,6 +457,14 @@ int main(int argc, char **argv)
         }
         else
         {
+            int location = find_record(argv[3], &handle);
+            if(location != -1 && handle.pass_headers[location].record_type != RECORD_TYPE_PASS)
+            {
+                handle_errors(DB_RECORD_WRONG_TYPE);
+                close_handle(&handle);
+                return 1;
+            }
+
             char *output = get_pass(argv[3], &handle);
             if(output)
             {
@@ -170,7 +504,7 @@ int main(int argc, char **argv)
             printf("(Maximum 10000 characters)\n$ ");
             scanf("%d", &pass_size);
 
-            while(pass_size > 10000)
+            while(pass_size > MAX_GEN_PASS_LENGTH)
             {
                 printf("\nPasswords can't be over 10000 characters long\n");
                 printf("Please enter a smaller value\n$ ");
@@ -191,6 +525,74 @@ int main(int argc, char **argv)
             }
         }
     }
+    else if(strcmp(argv[1], "put") == 0)
+    {
+        if(argc != 5)
+        {
+            printf("\nError: Invalid command\nType '<program> help' to get list of commands and proper usage\n\n");
+            return 1;
+        }
+
+        prompt_pass();
+        if(error_code = open_pass_db(argv[2], password, &handle))
+        {
+            handle_errors(error_code);
+            return 1;
+        }
+        else
+        {
+            int infd = open(argv[4], O_RDONLY);
+            if(infd == -1)
+            {
+                handle_errors(DB_FILE_NOT_FOUND);
+                close_handle(&handle);
+                return 1;
+            }
+
+            error_code = put_blob(argv[3], infd, &handle);
+            close(infd);
+            if(error_code)
+            {
+                handle_errors(error_code);
+                close_handle(&handle);
+                return 1;
+            }
+            else
+            {
+                printf("\nBlob successfully added to database\n\n");
+                close_handle(&handle);
+                return 0;
+            }
+        }
+    }
+    else if(strcmp(argv[1], "cat") == 0)
+    {
+        if(argc != 4)
+        {
+            printf("\nError: Invalid command\nType '<program> help' to get list of commands and proper usage\n\n");
+            return 1;
+        }
+
+        // Password prompt and errors go to stderr so stdout only holds blob data
+        prompt_pass_to(stderr);
+        if(error_code = open_pass_db(argv[2], password, &handle))
+        {
+            handle_errors_to(stderr, error_code);
+            return 1;
+        }
+        else
+        {
+            fprintf(stderr, "\n");
+            if(error_code = cat_blob(argv[3], STDOUT_FILENO, &handle))
+            {
+                handle_errors_to(stderr, error_code);
+                close_handle(&handle);
+                return 1;
+            }
+            close_handle(&handle);
+            return 0;
+        }
+    }
     else if(strcmp(argv[1], "remove") == 0)
     {
         if(argc != 4)
@@ -255,6 +657,161 @@ int main(int argc, char **argv)
             return 0;
         }
     }
+    else if(strcmp(argv[1], "verify") == 0)
+    {
+        prompt_pass();
+        if(error_code = open_pass_db(argv[2], password, &handle))
+        {
+            handle_errors(error_code);
+            return 1;
+        }
+        else
+        {
+            if(error_code = verify_db(&handle))
+            {
+                handle_errors(error_code);
+                close_handle(&handle);
+                return 1;
+            }
+            else
+            {
+                printf("Database successfully verified\n\n");
+                close_handle(&handle);
+                return 0;
+            }
+        }
+    }
+    else if(strcmp(argv[1], "batch") == 0)
+    {
+        // Password prompt and errors go to stderr so stdout only holds results
+        prompt_pass_to(stderr);
+        if(error_code = open_pass_db(argv[2], password, &handle))
+        {
+            handle_errors_to(stderr, error_code);
+            return 1;
+        }
+        else
+        {
+            FILE *infile = stdin;
+            if(argc == 4 && !(infile = fopen(argv[3], "r")))
+            {
+                handle_errors_to(stderr, DB_FILE_NOT_FOUND);
+                close_handle(&handle);
+                return 1;
+            }
+            fprintf(stderr, "\n");
+
+            error_code = run_batch(infile, &handle);
+
+            if(infile != stdin)
+            {
+                fclose(infile);
+            }
+            close_handle(&handle);
+            return error_code;
+        }
+    }
+    else if(strcmp(argv[1], "watch") == 0)
+    {
+        if(argc != 3)
+        {
+            printf("\nError: Invalid command\nType '<program> help' to get list of commands and proper usage\n\n");
+            return 1;
+        }
+
+        prompt_pass();
+        if(error_code = open_pass_db(argv[2], password, &handle))
+        {
+            handle_errors(error_code);
+            return 1;
+        }
+
+        db_watch_t watch;
+        if(error_code = watch_db(&watch, &handle))
+        {
+            handle_errors(error_code);
+            close_handle(&handle);
+            return 1;
+        }
+        subscribe_watch(&watch, print_watch_event, NULL);
+
+        printf("\nWatching %s for changes\n\n", argv[2]);
+        fflush(stdout);
+        while((error_code = poll_watch(&watch, -1)) != DB_WATCH_ERROR)
+        {
+            // Reload errors were already reported to subscribers, so keep watching
+        }
+
+        handle_errors(error_code);
+        close_watch(&watch);
+        close_handle(&handle);
+        return 1;
+    }
+    else if(strcmp(argv[1], "audit") == 0)
+    {
+        long max_age = AUDIT_DEFAULT_MAX_AGE;
+        if(argc == 4 || (argc == 5 && (strcmp(argv[3], "--max-age") != 0 || (max_age = parse_duration(argv[4])) == -1)))
+        {
+            printf("\nError: Invalid command\nType '<program> help' to get list of commands and proper usage\n\n");
+            return 1;
+        }
+
+        prompt_pass();
+        if(error_code = open_pass_db(argv[2], password, &handle))
+        {
+            handle_errors(error_code);
+            return 1;
+        }
+        else
+        {
+            if(error_code = audit_db(max_age, &handle))
+            {
+                handle_errors(error_code);
+                close_handle(&handle);
+                return 1;
+            }
+            else
+            {
+                printf("No problems found\n\n");
+                close_handle(&handle);
+                return 0;
+            }
+        }
+    }
+    else if(strcmp(argv[1], "rotate") == 0)
+    {
+        long max_age;
+        if(argc != 5 || strcmp(argv[3], "--older-than") != 0 || (max_age = parse_duration(argv[4])) == -1)
+        {
+            printf("\nError: Invalid command\nType '<program> help' to get list of commands and proper usage\n\n");
+            return 1;
+        }
+
+        prompt_pass();
+        if(error_code = open_pass_db(argv[2], password, &handle))
+        {
+            handle_errors(error_code);
+            return 1;
+        }
+        else
+        {
+            // A cutoff before the epoch matches no records
+            uint32_t num_rotated = 0;
+            time_t now = time(NULL);
+            if(max_age < now && (error_code = rotate_records(now - max_age, &num_rotated, &handle)))
+            {
+                handle_errors(error_code);
+                close_handle(&handle);
+                return 1;
+            }
+            else
+            {
+                printf("\n%u passwords successfully rotated\n\n", num_rotated);
+                close_handle(&handle);
+                return 0;
+            }
+        }
+    }
     else
     {
         printf("\nError: Invalid command\nType '<program> help' to get list of commands and proper usage\n\n");
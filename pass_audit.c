@@ -0,0 +1,272 @@
+#include "pass_audit.h"
+#include "pass_defines.h"
+#include "pass_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+// Result of auditing a single record
+typedef struct audit_result
+{
+    unsigned char digest[AUDIT_DIGEST_LENGTH];
+    double entropy_bits;
+    uint32_t problems;
+} audit_result_t;
+
+// Shared state for audit workers
+typedef struct audit_state
+{
+    db_handle_t *handle;
+    audit_result_t *results;
+    char *digest_key;
+} audit_state_t;
+
+// Estimate the entropy of a password in bits as length * log2(pool size), where the pool
+// is every character class the password draws from. Character frequencies in one short
+// password say little about how it was chosen, and would cap random passwords at
+// length * log2(length) bits
+static double pass_entropy(char *pass, uint64_t length)
+{
+    int has_lower = 0, has_upper = 0, has_digit = 0, has_symbol = 0, has_other = 0;
+
+    uint64_t i;
+    for(i = 0; i < length; i++)
+    {
+        unsigned char c = pass[i];
+        if(c >= 'a' && c <= 'z')
+        {
+            has_lower = 1;
+        }
+        else if(c >= 'A' && c <= 'Z')
+        {
+            has_upper = 1;
+        }
+        else if(c >= '0' && c <= '9')
+        {
+            has_digit = 1;
+        }
+        else if(c >= ' ' && c <= '~')
+        {
+            has_symbol = 1;
+        }
+        else
+        {
+            has_other = 1;
+        }
+    }
+
+    // Symbols are the 33 printable ASCII characters that aren't letters or digits, including space
+    // Other covers the remaining byte values
+    uint32_t pool = has_lower * 26 + has_upper * 26 + has_digit * 10 + has_symbol * 33 + has_other * 161;
+    return pool ? length * log2(pool) : 0;
+}
+
+// Decrypt one record, take its keyed digest and entropy, then wipe the plaintext
+static void audit_record(uint32_t index, gcry_cipher_hd_t crypt_handle, void *arg)
+{
+    audit_state_t *state = arg;
+    pass_header_t *header = &state->handle->pass_headers[index];
+    audit_result_t *result = &state->results[index];
+
+    if(header->record_type != RECORD_TYPE_PASS)
+    {
+        return;
+    }
+
+    // Records with bad bounds can't be safely decrypted
+    if(!record_size_valid(header) || !record_in_bounds(header, state->handle->pass_data_size))
+    {
+        result->problems |= AUDIT_UNREADABLE;
+        return;
+    }
+
+    char *pass_buff = malloc(header->record_size);
+    memcpy(pass_buff, state->handle->pass_data + header->record_start, header->record_size);
+
+    gcry_cipher_setiv(crypt_handle, state->handle->iv, IV_LENGTH);
+    if(gcry_cipher_decrypt(crypt_handle, pass_buff, header->record_size, NULL, 0))
+    {
+        result->problems |= AUDIT_UNREADABLE;
+    }
+    else
+    {
+        // Digest is keyed with a random per-audit key so it can't be matched outside this run
+        gcry_md_hd_t md_handle;
+        gcry_error_t err = gcry_md_open(&md_handle, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
+        if(!err)
+        {
+            err = gcry_md_setkey(md_handle, state->digest_key, KEY_SIZE);
+        }
+        if(err)
+        {
+            printf("%s\n", gcry_strerror(err));
+            exit(EXIT_FAILURE);
+        }
+
+        gcry_md_write(md_handle, pass_buff, header->pass_size);
+        memcpy(result->digest, gcry_md_read(md_handle, GCRY_MD_SHA256), AUDIT_DIGEST_LENGTH);
+        gcry_md_close(md_handle);
+
+        result->entropy_bits = pass_entropy(pass_buff, header->pass_size);
+    }
+
+    memset(pass_buff, 0, header->record_size);
+    free(pass_buff);
+}
+
+// Decrypt every record of an opened database across all cores and report each password's
+// length and entropy along with duplicate, weak and expired passwords
+// Records created more than max_age seconds ago are expired
+// Returns DB_AUDIT_FAILED if any problems were found
+int audit_db(uint64_t max_age, db_handle_t *handle)
+{
+    uint32_t num_records = handle->num_records;
+    if(num_records == 0)
+    {
+        return DB_NO_RECORDS;
+    }
+
+    audit_state_t state;
+    state.handle = handle;
+    state.results = calloc(num_records, sizeof(audit_result_t));
+    state.digest_key = gcry_malloc_secure(KEY_SIZE);
+    gcry_randomize(state.digest_key, KEY_SIZE, GCRY_STRONG_RANDOM);
+
+    run_record_pool(handle, audit_record, &state);
+
+    memset(state.digest_key, 0, KEY_SIZE);
+    gcry_free(state.digest_key);
+
+    // Find duplicates by inserting every digest into an open addressing hash set
+    // Each slot holds the index + 1 of the first record seen with that digest
+    uint32_t table_size = 1;
+    while(table_size < num_records * 2)
+    {
+        table_size <<= 1;
+    }
+    uint32_t *table = calloc(table_size, sizeof(uint32_t));
+    uint32_t *first_seen = malloc(sizeof(uint32_t) * num_records);
+
+    uint64_t now = time(NULL);
+    uint32_t num_passwords = 0;
+    uint32_t i;
+    for(i = 0; i < num_records; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[i];
+        audit_result_t *result = &state.results[i];
+        first_seen[i] = i;
+
+        if(header->record_type != RECORD_TYPE_PASS)
+        {
+            continue;
+        }
+        num_passwords++;
+
+        if(header->create_time < now && now - header->create_time > max_age)
+        {
+            result->problems |= AUDIT_EXPIRED;
+        }
+        if(result->problems & AUDIT_UNREADABLE)
+        {
+            continue;
+        }
+        if(header->pass_size < AUDIT_MIN_PASS_LENGTH)
+        {
+            result->problems |= AUDIT_TOO_SHORT;
+        }
+        if(result->entropy_bits < AUDIT_MIN_ENTROPY_BITS)
+        {
+            result->problems |= AUDIT_LOW_ENTROPY;
+        }
+
+        uint32_t slot;
+        memcpy(&slot, result->digest, sizeof(slot));
+        slot &= table_size - 1;
+        while(table[slot])
+        {
+            uint32_t other = table[slot] - 1;
+            if(memcmp(state.results[other].digest, result->digest, AUDIT_DIGEST_LENGTH) == 0)
+            {
+                result->problems |= AUDIT_DUPLICATE;
+                state.results[other].problems |= AUDIT_DUPLICATE;
+                first_seen[i] = other;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if(!table[slot])
+        {
+            table[slot] = i + 1;
+        }
+    }
+
+    // Report the length and entropy of every password, followed by any problems found
+    uint32_t num_problems = 0;
+    uint32_t num_duplicates = 0, num_short = 0, num_weak = 0, num_expired = 0, num_unreadable = 0;
+    printf("\n");
+    for(i = 0; i < num_records; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[i];
+        audit_result_t *result = &state.results[i];
+        if(header->record_type != RECORD_TYPE_PASS)
+        {
+            continue;
+        }
+
+        printf("Name: %s | %lu characters long |", header->name, (unsigned long) header->pass_size);
+        if(result->problems & AUDIT_UNREADABLE)
+        {
+            printf(" unreadable;");
+            num_unreadable++;
+        }
+        else
+        {
+            printf(" %.1f bits of entropy;", result->entropy_bits);
+        }
+        num_problems += result->problems != 0;
+        if(result->problems & AUDIT_DUPLICATE)
+        {
+            if(first_seen[i] != i)
+            {
+                printf(" same password as %s;", handle->pass_headers[first_seen[i]].name);
+            }
+            else
+            {
+                printf(" password reused by other records;");
+            }
+            num_duplicates++;
+        }
+        if(result->problems & AUDIT_TOO_SHORT)
+        {
+            printf(" shorter than %d characters;", AUDIT_MIN_PASS_LENGTH);
+            num_short++;
+        }
+        if(result->problems & AUDIT_LOW_ENTROPY)
+        {
+            printf(" less than %d bits of entropy;", AUDIT_MIN_ENTROPY_BITS);
+            num_weak++;
+        }
+        if(result->problems & AUDIT_EXPIRED)
+        {
+            printf(" %lu days old;", (unsigned long) ((now - header->create_time) / (24 * 60 * 60)));
+            num_expired++;
+        }
+        printf("\n");
+    }
+
+    printf("\nPasswords Audited: %u\n", num_passwords);
+    printf("Reused: %u\n", num_duplicates);
+    printf("Too Short: %u\n", num_short);
+    printf("Low Entropy: %u\n", num_weak);
+    printf("Expired: %u\n", num_expired);
+    printf("Unreadable: %u\n", num_unreadable);
+    printf("Worker Threads: %d\n\n", pool_size(num_records));
+
+    memset(state.results, 0, sizeof(audit_result_t) * num_records);
+    free(state.results);
+    free(table);
+    free(first_seen);
+
+    return num_problems ? DB_AUDIT_FAILED : 0;
+}
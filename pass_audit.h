@@ -0,0 +1,8 @@
+#ifndef PASS_AUDIT_H
+#define PASS_AUDIT_H
+
+#include "pass_db.h"
+
+int audit_db(uint64_t max_age, db_handle_t *handle);
+
+#endif
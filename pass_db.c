@@ -1,11 +1,14 @@
 #include "pass_db.h"
 #include "pass_defines.h"
+#include "pass_pool.h"
 #include <stdlib.h>
 #include <time.h>
 #include <gcrypt.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 // Initialize libgcrypt library
 void init_gcrypt()
@@ -21,34 +24,83 @@ void init_gcrypt()
     gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
 }
 
+// Size of the encrypted block holding a password length bytes long
+// (null terminated and padded to AES block length)
+uint64_t pass_block_length(uint64_t length)
+{
+    return (length + 1) % AES_BLOCK_LENGTH ? length + 1 + AES_BLOCK_LENGTH - ((length + 1) % AES_BLOCK_LENGTH) : length + 1;
+}
+
 // Generate a random password length bytes long
 // Returns length of actual password block
 int generate_pass(unsigned char **pass_buff, int length)
 {
-    int password_block_length = (length + 1) % AES_BLOCK_LENGTH ? length + 1 + AES_BLOCK_LENGTH - ((length + 1) % AES_BLOCK_LENGTH) : length + 1;
-    *pass_buff = malloc(password_block_length);
-    gcry_randomize(*pass_buff, password_block_length, GCRY_STRONG_RANDOM);
-            
-    // Make password characters readable 
-    int i;
-    for(i = 0; i < length; i++)
+    uint64_t pass_length = length;
+    return generate_passes(pass_buff, &pass_length, 1);
+}
+
+// Generate count random passwords into one buffer with a single call to the random generator
+// Password i is lengths[i] bytes long and its block follows the block of password i - 1
+// Returns total length of all password blocks
+uint64_t generate_passes(unsigned char **pass_buff, uint64_t *lengths, uint32_t count)
+{
+    uint64_t total_length = 0;
+    uint32_t i;
+    for(i = 0; i < count; i++)
     {
-        (*pass_buff)[i] = (*pass_buff)[i] % ('~' - ' ') + ' ';
+        total_length += pass_block_length(lengths[i]);
     }
     
-    // Pad end of password with null terminators
-    for(i = length; i < password_block_length; i++)
+    *pass_buff = malloc(total_length);
+    gcry_randomize(*pass_buff, total_length, GCRY_STRONG_RANDOM);
+    
+    unsigned char *block = *pass_buff;
+    for(i = 0; i < count; i++)
     {
-        (*pass_buff)[i] = '\0';
+        uint64_t password_block_length = pass_block_length(lengths[i]);
+        
+        // Make password characters readable 
+        uint64_t j;
+        for(j = 0; j < lengths[i]; j++)
+        {
+            block[j] = block[j] % ('~' - ' ') + ' ';
+        }
+        
+        // Pad end of password with null terminators
+        for(j = lengths[i]; j < password_block_length; j++)
+        {
+            block[j] = '\0';
+        }
+        
+        block += password_block_length;
     }
     
-    return password_block_length;
+    return total_length;
+}
+
+// Derive encryption key using scrypt algorithm and initialize cipher handle for encryption/decryption
+// Key is kept in secure memory so worker threads can open their own cipher handles
+static void init_crypt_handle(char *password, char *salt, char *iv, db_handle_t *handle)
+{
+    handle->key = gcry_malloc_secure(KEY_SIZE);
+    gcry_kdf_derive(password, strlen(password), GCRY_KDF_SCRYPT, KEY_GEN_N, salt, SALT_LENGTH, KEY_GEN_P, KEY_SIZE, handle->key);
+    
+    gcry_cipher_open(&(handle->crypt_handle), GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CBC, 0);
+    gcry_cipher_setkey(handle->crypt_handle, handle->key, KEY_SIZE);
+    gcry_cipher_setiv(handle->crypt_handle, iv, IV_LENGTH);
 }
 
 // Create a new password database file and initialize database handle
 int create_pass_db(char *filename, char *password, db_handle_t *handle)
 {
-    if(access(filename, F_OK) != -1)
+    // A leftover blob file would be taken for this database's blob data
+    char *blob_name = malloc(strlen(filename) + strlen(BLOB_FILE_SUFFIX) + 1);
+    strcpy(blob_name, filename);
+    strcat(blob_name, BLOB_FILE_SUFFIX);
+    int blob_exists = access(blob_name, F_OK) != -1;
+    free(blob_name);
+    
+    if(access(filename, F_OK) != -1 || blob_exists)
     {
         return DB_FILE_EXISTS;
     }
@@ -61,14 +113,7 @@ int create_pass_db(char *filename, char *password, db_handle_t *handle)
     char iv[IV_LENGTH];
     gcry_randomize(iv, IV_LENGTH, GCRY_STRONG_RANDOM);
 
-    // Derive encryption key using scrypt algorithm
-    char *key = malloc(KEY_SIZE);
-    gcry_kdf_derive(password, strlen(password), GCRY_KDF_SCRYPT, KEY_GEN_N, salt, SALT_LENGTH, KEY_GEN_P, KEY_SIZE, key);
-        
-    // Initialize cipher handle for encryption/decryption
-    gcry_cipher_open(&(handle->crypt_handle), GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CBC, 0);
-    gcry_cipher_setkey(handle->crypt_handle, key, KEY_SIZE);
-    gcry_cipher_setiv(handle->crypt_handle, iv, IV_LENGTH);
+    init_crypt_handle(password, salt, iv, handle);
         
     // Initialize db header struct
     handle->filename = malloc(strlen(filename) + 1);
@@ -86,11 +131,14 @@ int create_pass_db(char *filename, char *password, db_handle_t *handle)
     handle->pass_headers = NULL;
     handle->pass_data = NULL;
     handle->pass_data_size = 0;
+    handle->owns_blob_file = 0;
         
     // Write handle to file
     return write_handle(handle);
 }
 
+static int recover_compaction(db_handle_t *handle);
+
 // Open an existing password database
 int open_pass_db(char *infilename, char *password, db_handle_t *handle)
 {
@@ -123,98 +171,408 @@ int open_pass_db(char *infilename, char *password, db_handle_t *handle)
         handle->iv = malloc(IV_LENGTH);
         fread(handle->iv, sizeof(char), IV_LENGTH, infile);
         
-        // Derive encryption key using scrypt algorithm
-        char *key = malloc(KEY_SIZE);
-        gcry_kdf_derive(password, strlen(password), GCRY_KDF_SCRYPT, KEY_GEN_N, handle->salt, SALT_LENGTH, KEY_GEN_P, KEY_SIZE, key);
-        
-        // Initialize cipher handle for encryption/decryption
-        gcry_cipher_open(&(handle->crypt_handle), GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CBC, 0);
-        gcry_cipher_setkey(handle->crypt_handle, key, KEY_SIZE);
-        gcry_cipher_setiv(handle->crypt_handle, handle->iv, IV_LENGTH);
-        
-        memset(key, 0, KEY_SIZE);
-        free(key);
-        
-        // Read and decrypt database header from next 16 bytes
-        char db_header[DB_HEADER_LENGTH];
-        fread(db_header, DB_HEADER_LENGTH, 1, infile);
+        init_crypt_handle(password, handle->salt, handle->iv, handle);
         
-        error = gcry_cipher_decrypt(handle->crypt_handle, db_header, DB_HEADER_LENGTH, NULL, 0);
-        if(error)
-        {
-            printf("%s\n", gcry_strerror(error));
-            exit(EXIT_FAILURE);
-        }
+        handle->filename = malloc(strlen(infilename) + 1);
+        strcpy(handle->filename, infilename);
         
-        // Check for magic constant to verify database
-        uint32_t magic_check;
-        memcpy(&magic_check, db_header, sizeof(uint32_t));
-        if(magic_check != MAGIC_DB_CONSTANT)
+        int error_code;
+        if(error_code = read_headers(infile, file_size, handle, &handle->num_records, &handle->last_edit, &handle->pass_headers))
         {
-            return DB_BAD_MAGIC;
+            fclose(infile);
+            return error_code;
         }
         
-        // Load header data into handle struct
-        memcpy(&(handle->num_records), db_header + sizeof(uint32_t), sizeof(uint32_t));
-        memcpy(&(handle->last_edit), db_header + sizeof(uint32_t) * 2 , sizeof(uint64_t));
-        
-        handle->filename = malloc(strlen(infilename) + 1);
-        strcpy(handle->filename, infilename);
-        
         if(handle->num_records > 0)
         {
-            // Read and decrypt password header data into pass_header structs
-
-            handle->pass_headers = malloc(sizeof(pass_header_t) * handle->num_records);
-            char header_block[PASS_HEADER_LENGTH];
-            
-            int i;
-            for(i = 0; i < handle->num_records; i++)
-            {
-                fread(header_block, PASS_HEADER_LENGTH, 1, infile);
-                
-                error = gcry_cipher_decrypt(handle->crypt_handle, header_block, PASS_HEADER_LENGTH, NULL, 0);
-                if(error)
-                {
-                    printf("%s\n", gcry_strerror(error));
-                    exit(EXIT_FAILURE);
-                }
-                
-                pass_header_t *p_head = &handle->pass_headers[i];
-
-                int pass_size_offset = sizeof(p_head->name);
-                int create_time_offset = pass_size_offset + sizeof(p_head->pass_size);
-                int record_size_offset = create_time_offset + sizeof(p_head->create_time);
-                int record_start_offset = record_size_offset + sizeof(p_head->record_size);
-
-                memcpy(p_head->name, header_block, sizeof(p_head->name));
-                memcpy(&(p_head->pass_size), header_block + pass_size_offset, sizeof(p_head->pass_size));
-                memcpy(&(p_head->create_time), header_block + create_time_offset, sizeof(p_head->create_time));
-                memcpy(&(p_head->record_size), header_block + record_size_offset, sizeof(p_head->record_size));
-                memcpy(&(p_head->record_start), header_block + record_start_offset, sizeof(p_head->record_start));
-            }
-            
             // Read encrypted password data into handle
             handle->pass_data_size = file_size - ftell(infile);
             handle->pass_data = malloc(handle->pass_data_size);
             fread(handle->pass_data, handle->pass_data_size, 1, infile);
-            
-            fclose(infile);
         }
         else
         {
-            handle->pass_headers = NULL;
             handle->pass_data = NULL;
             handle->pass_data_size = 0;
         }
+        fclose(infile);
+        
+        // Only a database with blob records may change its blob file
+        handle->owns_blob_file = 0;
+        uint32_t i;
+        for(i = 0; i < handle->num_records; i++)
+        {
+            if(handle->pass_headers[i].record_type == RECORD_TYPE_BLOB)
+            {
+                handle->owns_blob_file = 1;
+            }
+        }
+        return recover_compaction(handle);
+    }
+}
+
+static int read_header_section(FILE *infile, long file_size, uint32_t header_section_length, db_handle_t *handle, uint32_t *num_records, pass_header_t **pass_headers);
+static int decode_header_section(unsigned char *section, long length, uint32_t *num_records, pass_header_t **pass_headers);
+static int read_legacy_headers(FILE *infile, long file_size, db_handle_t *handle, uint32_t num_records, pass_header_t **pass_headers);
+static int get_varint(unsigned char *buff, long length, long *pos, uint64_t *value);
+
+// Read and decrypt the database header and password headers that follow the salt and IV
+// Leaves infile positioned at the start of the password data
+int read_headers(FILE *infile, long file_size, db_handle_t *handle, uint32_t *num_records, uint64_t *last_edit, pass_header_t **pass_headers)
+{
+    // Re-initialize iv so header decryption is consistent
+    gcry_cipher_setiv(handle->crypt_handle, handle->iv, IV_LENGTH);
+    
+    // Read and decrypt database header from next 16 bytes
+    char db_header[DB_HEADER_LENGTH];
+    if(fread(db_header, DB_HEADER_LENGTH, 1, infile) != 1)
+    {
+        return DB_BAD_FILE_SIZE;
+    }
+    
+    error = gcry_cipher_decrypt(handle->crypt_handle, db_header, DB_HEADER_LENGTH, NULL, 0);
+    if(error)
+    {
+        printf("%s\n", gcry_strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    
+    // Check for magic constant to verify database
+    uint32_t magic_check;
+    memcpy(&magic_check, db_header, sizeof(uint32_t));
+    memcpy(last_edit, db_header + sizeof(uint32_t) * 2 , sizeof(uint64_t));
+    
+    if(magic_check == MAGIC_DB_CONSTANT)
+    {
+        uint32_t header_section_length;
+        memcpy(&header_section_length, db_header + sizeof(uint32_t), sizeof(uint32_t));
+        return read_header_section(infile, file_size, header_section_length, handle, num_records, pass_headers);
+    }
+    else if(magic_check == LEGACY_MAGIC_DB_CONSTANT)
+    {
+        memcpy(num_records, db_header + sizeof(uint32_t), sizeof(uint32_t));
+        return read_legacy_headers(infile, file_size, handle, *num_records, pass_headers);
+    }
+    return DB_BAD_MAGIC;
+}
+
+// Read and decrypt a varint encoded header section of header_section_length bytes
+static int read_header_section(FILE *infile, long file_size, uint32_t header_section_length, db_handle_t *handle, uint32_t *num_records, pass_header_t **pass_headers)
+{
+    // File must be large enough to hold the whole header section
+    long headers_end = SALT_LENGTH + IV_LENGTH + DB_HEADER_LENGTH + (long) header_section_length;
+    if(header_section_length % AES_BLOCK_LENGTH || headers_end > file_size)
+    {
+        return DB_BAD_FILE_SIZE;
+    }
+    
+    unsigned char *section = malloc(header_section_length + 1);
+    if(header_section_length && fread(section, header_section_length, 1, infile) != 1)
+    {
+        free(section);
+        return DB_BAD_FILE_SIZE;
+    }
+    
+    error = gcry_cipher_decrypt(handle->crypt_handle, section, header_section_length, NULL, 0);
+    if(error)
+    {
+        printf("%s\n", gcry_strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    
+    int error_code = decode_header_section(section, header_section_length, num_records, pass_headers);
+    
+    memset(section, 0, header_section_length);
+    free(section);
+    return error_code;
+}
+
+// Parse a decrypted header section: a varint record count, the varint fields of every
+// record, then a string table of varint length prefixed names
+static int decode_header_section(unsigned char *section, long length, uint32_t *num_records, pass_header_t **pass_headers)
+{
+    long pos = 0;
+    uint64_t count;
+    
+    // Every record takes at least one byte per field, which bounds the count before allocating
+    if(get_varint(section, length, &pos, &count) || count > (uint64_t) length / HEADER_FIELD_COUNT)
+    {
+        return DB_BAD_HEADER;
+    }
+    
+    *num_records = count;
+    *pass_headers = count ? calloc(count, sizeof(pass_header_t)) : NULL;
+    uint64_t *name_indices = malloc(sizeof(uint64_t) * (count + 1));
+    
+    int error_code = 0;
+    uint32_t i;
+    for(i = 0; i < count && !error_code; i++)
+    {
+        pass_header_t *p_head = &(*pass_headers)[i];
+        uint64_t record_type;
+        
+        if(get_varint(section, length, &pos, &record_type) ||
+           get_varint(section, length, &pos, &p_head->pass_size) ||
+           get_varint(section, length, &pos, &p_head->create_time) ||
+           get_varint(section, length, &pos, &p_head->record_size) ||
+           get_varint(section, length, &pos, &p_head->record_start) ||
+           get_varint(section, length, &pos, &name_indices[i]))
+        {
+            error_code = DB_BAD_HEADER;
+        }
+        p_head->record_type = record_type;
+    }
+    
+    // Read string table and resolve record names
+    uint64_t num_strings;
+    if(!error_code && (get_varint(section, length, &pos, &num_strings) || num_strings > (uint64_t) length))
+    {
+        error_code = DB_BAD_HEADER;
+    }
+    
+    long *string_starts = malloc(sizeof(long) * ((error_code ? 0 : num_strings) + 1));
+    uint64_t *string_lengths = malloc(sizeof(uint64_t) * ((error_code ? 0 : num_strings) + 1));
+    for(i = 0; !error_code && i < num_strings; i++)
+    {
+        if(get_varint(section, length, &pos, &string_lengths[i]) || string_lengths[i] > (uint64_t) (length - pos))
+        {
+            error_code = DB_BAD_HEADER;
+            break;
+        }
+        string_starts[i] = pos;
+        pos += string_lengths[i];
+    }
+    
+    for(i = 0; !error_code && i < count; i++)
+    {
+        if(name_indices[i] >= num_strings)
+        {
+            error_code = DB_BAD_HEADER;
+            break;
+        }
+        
+        uint64_t name_length = string_lengths[name_indices[i]];
+        (*pass_headers)[i].name = malloc(name_length + 1);
+        memcpy((*pass_headers)[i].name, section + string_starts[name_indices[i]], name_length);
+        (*pass_headers)[i].name[name_length] = '\0';
+    }
+    
+    free(name_indices);
+    free(string_starts);
+    free(string_lengths);
+    
+    if(error_code)
+    {
+        free_headers(*pass_headers, count);
+        *pass_headers = NULL;
+    }
+    return error_code;
+}
+
+// Read and decrypt fixed size password headers written before headers were varint encoded
+static int read_legacy_headers(FILE *infile, long file_size, db_handle_t *handle, uint32_t num_records, pass_header_t **pass_headers)
+{
+    // File must be large enough to hold every password header
+    long headers_end = SALT_LENGTH + IV_LENGTH + DB_HEADER_LENGTH + (long) LEGACY_PASS_HEADER_LENGTH * num_records;
+    if(headers_end > file_size)
+    {
+        return DB_BAD_FILE_SIZE;
+    }
+    
+    if(num_records == 0)
+    {
+        *pass_headers = NULL;
         return 0;
     }
+    
+    // Read and decrypt password header data into pass_header structs
+    *pass_headers = malloc(sizeof(pass_header_t) * num_records);
+    char header_block[LEGACY_PASS_HEADER_LENGTH];
+    
+    uint32_t i;
+    for(i = 0; i < num_records; i++)
+    {
+        fread(header_block, LEGACY_PASS_HEADER_LENGTH, 1, infile);
+        
+        error = gcry_cipher_decrypt(handle->crypt_handle, header_block, LEGACY_PASS_HEADER_LENGTH, NULL, 0);
+        if(error)
+        {
+            printf("%s\n", gcry_strerror(error));
+            exit(EXIT_FAILURE);
+        }
+        
+        pass_header_t *p_head = &(*pass_headers)[i];
+
+        int pass_size_offset = LEGACY_NAME_LENGTH;
+        int create_time_offset = pass_size_offset + sizeof(p_head->pass_size);
+        int record_size_offset = create_time_offset + sizeof(p_head->create_time);
+        int record_start_offset = record_size_offset + sizeof(p_head->record_size);
+
+        p_head->name = malloc(LEGACY_NAME_LENGTH + 1);
+        memcpy(p_head->name, header_block, LEGACY_NAME_LENGTH);
+        p_head->name[LEGACY_NAME_LENGTH] = '\0';
+        
+        memcpy(&(p_head->pass_size), header_block + pass_size_offset, sizeof(p_head->pass_size));
+        memcpy(&(p_head->create_time), header_block + create_time_offset, sizeof(p_head->create_time));
+        memcpy(&(p_head->record_size), header_block + record_size_offset, sizeof(p_head->record_size));
+        memcpy(&(p_head->record_start), header_block + record_start_offset, sizeof(p_head->record_start));
+        
+        // Record type is stored in the top bit of the password size
+        p_head->record_type = p_head->pass_size & BLOB_RECORD_FLAG ? RECORD_TYPE_BLOB : RECORD_TYPE_PASS;
+        p_head->pass_size &= ~BLOB_RECORD_FLAG;
+    }
+    memset(header_block, 0, LEGACY_PASS_HEADER_LENGTH);
+    
+    return 0;
+}
+
+// Number of bytes needed to varint encode value
+static int varint_length(uint64_t value)
+{
+    int length = 1;
+    while(value >= 0x80)
+    {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+// Varint encode value into buff (7 bits per byte, least significant first)
+// Returns number of bytes written
+static int put_varint(unsigned char *buff, uint64_t value)
+{
+    int length = 0;
+    while(value >= 0x80)
+    {
+        buff[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buff[length++] = value;
+    return length;
+}
+
+// Decode a varint from buff at *pos, advancing *pos past it
+// Returns -1 if the varint runs past length or overflows 64 bits
+static int get_varint(unsigned char *buff, long length, long *pos, uint64_t *value)
+{
+    *value = 0;
+    int shift;
+    for(shift = 0; shift < 64 && *pos < length; shift += 7)
+    {
+        unsigned char byte = buff[(*pos)++];
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Encode the headers of an opened database into a header section padded to AES block length
+// Returns length of the header section
+static uint32_t encode_header_section(unsigned char **section, db_handle_t *handle)
+{
+    // Record count and string table count
+    uint64_t length = varint_length(handle->num_records) + varint_length(handle->num_records);
+    uint32_t i;
+    for(i = 0; i < handle->num_records; i++)
+    {
+        pass_header_t *p_head = &handle->pass_headers[i];
+        uint64_t name_length = strlen(p_head->name);
+        
+        length += varint_length(p_head->record_type) + varint_length(p_head->pass_size) +
+                  varint_length(p_head->create_time) + varint_length(p_head->record_size) +
+                  varint_length(p_head->record_start) + varint_length(i) +
+                  varint_length(name_length) + name_length;
+    }
+    if(length % AES_BLOCK_LENGTH)
+    {
+        length += AES_BLOCK_LENGTH - length % AES_BLOCK_LENGTH;
+    }
+    
+    *section = calloc(length, 1);
+    unsigned char *pos = *section;
+    
+    // Record fields, each name referring to its entry in the string table
+    pos += put_varint(pos, handle->num_records);
+    for(i = 0; i < handle->num_records; i++)
+    {
+        pass_header_t *p_head = &handle->pass_headers[i];
+        pos += put_varint(pos, p_head->record_type);
+        pos += put_varint(pos, p_head->pass_size);
+        pos += put_varint(pos, p_head->create_time);
+        pos += put_varint(pos, p_head->record_size);
+        pos += put_varint(pos, p_head->record_start);
+        pos += put_varint(pos, i);
+    }
+    
+    // String table of length prefixed names
+    pos += put_varint(pos, handle->num_records);
+    for(i = 0; i < handle->num_records; i++)
+    {
+        uint64_t name_length = strlen(handle->pass_headers[i].name);
+        pos += put_varint(pos, name_length);
+        memcpy(pos, handle->pass_headers[i].name, name_length);
+        pos += name_length;
+    }
+    
+    return length;
+}
+
+// Zero out and free an array of password headers along with their names
+void free_headers(pass_header_t *pass_headers, uint32_t num_records)
+{
+    uint32_t i;
+    for(i = 0; pass_headers && i < num_records; i++)
+    {
+        if(pass_headers[i].name)
+        {
+            memset(pass_headers[i].name, 0, strlen(pass_headers[i].name));
+            free(pass_headers[i].name);
+        }
+    }
+    if(pass_headers)
+    {
+        memset(pass_headers, 0, sizeof(pass_header_t) * num_records);
+    }
+    free(pass_headers);
 }
 
 // Add a new password record to an exisiting database
 int create_db_record(char *name, int pass_size, db_handle_t *handle)
 {
-    if(find_record(name, handle) != -1)
+    int error_code;
+    if(error_code = add_db_record(name, pass_size, handle))
+    {
+        return error_code;
+    }
+    return write_handle(handle);
+}
+
+// Remove a password record from an existing database
+int delete_db_record(char *name, db_handle_t *handle)
+{
+    int error_code;
+    if(error_code = remove_db_record(name, handle))
+    {
+        return error_code;
+    }
+    return write_handle(handle);
+}
+
+static void init_header(pass_header_t *header, char *name, uint32_t record_type);
+static void append_header(pass_header_t *header, db_handle_t *handle);
+
+// Add a new password record to an opened database without writing it to file
+int add_db_record(char *name, int pass_size, db_handle_t *handle)
+{
+    if(strlen(name) == 0 || strlen(name) > MAX_PASS_NAME_LENGTH)
+    {
+        return DB_BAD_RECORD_NAME;
+    }
+    else if(find_record(name, handle) != -1)
     {
         return DB_RECORD_EXISTS;
     }
@@ -225,20 +583,11 @@ int create_db_record(char *name, int pass_size, db_handle_t *handle)
     
     // Create new password header
     pass_header_t new_pass_header;
-    strcpy(new_pass_header.name, name);
-    
-    // Pad end of name with null terminators
-    int i;
-    for(i = strlen(new_pass_header.name); i < sizeof(new_pass_header.name); i++)
-    {
-        new_pass_header.name[i] = '\0';
-    }
+    init_header(&new_pass_header, name, RECORD_TYPE_PASS);
     
     // Start of new record is at end of current password block
     new_pass_header.record_start = handle->pass_data_size;
-
     new_pass_header.pass_size = pass_size;
-    new_pass_header.create_time = time(NULL);
 
     // Generate random password
     unsigned char *password_block;
@@ -275,6 +624,24 @@ int create_db_record(char *name, int pass_size, db_handle_t *handle)
     
     // Add new password header to handle headers
     new_pass_header.record_size = password_block_length;
+    append_header(&new_pass_header, handle);
+    
+    return 0;
+}
+
+// Initialize a new record header with its name, type and creation time
+static void init_header(pass_header_t *header, char *name, uint32_t record_type)
+{
+    header->name = malloc(strlen(name) + 1);
+    strcpy(header->name, name);
+    
+    header->record_type = record_type;
+    header->create_time = time(NULL);
+}
+
+// Add a record header to the end of an opened database's headers
+static void append_header(pass_header_t *header, db_handle_t *handle)
+{
     if(handle->num_records == 0)
     {
         handle->pass_headers = malloc(sizeof(pass_header_t));
@@ -288,13 +655,11 @@ int create_db_record(char *name, int pass_size, db_handle_t *handle)
         handle->pass_headers = new_headers;
     }
     handle->num_records++;
-    handle->pass_headers[handle->num_records - 1] = new_pass_header;
-    
-    return write_handle(handle);
+    handle->pass_headers[handle->num_records - 1] = *header;
 }
 
-// Remove a password record from an existing database
-int delete_db_record(char *name, db_handle_t *handle)
+// Remove a password record from an opened database without writing it to file
+int remove_db_record(char *name, db_handle_t *handle)
 {
     int location;
     if((location = find_record(name, handle)) == -1)
@@ -306,12 +671,17 @@ int delete_db_record(char *name, db_handle_t *handle)
     int record_end = header.record_start + header.record_size;
     
     // Remove password data from handle
-    char *new_pass_data = malloc(handle->pass_data_size - header.record_size);
-    memcpy(new_pass_data, handle->pass_data, header.record_start);
-    memcpy(new_pass_data, handle->pass_data + record_end, handle->pass_data_size - record_end);
-    
-    free(handle->pass_data);
-    handle->pass_data = new_pass_data;
+    // (blob data lives in the blob file and is left in place)
+    if(header.record_type == RECORD_TYPE_PASS)
+    {
+        char *new_pass_data = malloc(handle->pass_data_size - header.record_size);
+        memcpy(new_pass_data, handle->pass_data, header.record_start);
+        memcpy(new_pass_data + header.record_start, handle->pass_data + record_end, handle->pass_data_size - record_end);
+        
+        free(handle->pass_data);
+        handle->pass_data = new_pass_data;
+        handle->pass_data_size -= header.record_size;
+    }
     
     // Remove appropriate password header from handle
     pass_header_t *new_headers = malloc(sizeof(pass_header_t) * (handle->num_records - 1));
@@ -323,24 +693,43 @@ int delete_db_record(char *name, db_handle_t *handle)
     for(i = location; i < handle->num_records - 1; i++)
     {
         new_headers[i] = handle->pass_headers[i + 1];
-        new_headers[i].record_start -= header.record_size;    // Fix header record starts
+        if(header.record_type == RECORD_TYPE_PASS && new_headers[i].record_type == RECORD_TYPE_PASS &&
+           new_headers[i].record_start > header.record_start)
+        {
+            new_headers[i].record_start -= header.record_size;    // Fix header record starts
+        }
     }
     
     free(handle->pass_headers);
     handle->pass_headers = new_headers;
     handle->num_records--;
     
-    return write_handle(handle);
+    memset(header.name, 0, strlen(header.name));
+    free(header.name);
+    
+    return 0;
 }
 
+static int compact_blobs(uint64_t **old_starts, db_handle_t *handle);
+static int finish_compaction(uint64_t *old_starts, int error_code, db_handle_t *handle);
+
 // Write state of password database provided by db_handle to appropriate database file
 int write_handle(db_handle_t *handle)
 {
+    // Chunks of removed blobs are copied out before the headers are written, but the
+    // old blob file is only replaced once headers with the new offsets are on disk
+    uint64_t *old_starts;
+    int error_code;
+    if(error_code = compact_blobs(&old_starts, handle))
+    {
+        return error_code;
+    }
+    
     FILE *outfile = fopen(handle->filename, "wb");
     
     if(!outfile)
     {
-        return DB_FILE_OPEN_ERROR;
+        return finish_compaction(old_starts, DB_FILE_OPEN_ERROR, handle);
     }
 
     // Re-initialize iv so header encryption is consistent
@@ -352,12 +741,16 @@ int write_handle(db_handle_t *handle)
     
     handle->last_edit = time(NULL);
     
+    // Encode password headers into a varint header section
+    unsigned char *header_section;
+    uint32_t header_section_length = encode_header_section(&header_section, handle);
+    
     // Write encrypted database header to file
     char db_header[AES_BLOCK_LENGTH];
     uint32_t magic = MAGIC_DB_CONSTANT;
     memcpy(db_header, &magic, sizeof(uint32_t));
-    memcpy(db_header + sizeof(uint32_t), &(handle->num_records), sizeof(handle->num_records));
-    memcpy(db_header + sizeof(uint32_t) + sizeof(handle->num_records), &(handle->last_edit), sizeof(handle->last_edit));
+    memcpy(db_header + sizeof(uint32_t), &header_section_length, sizeof(header_section_length));
+    memcpy(db_header + sizeof(uint32_t) + sizeof(header_section_length), &(handle->last_edit), sizeof(handle->last_edit));
 
     error = gcry_cipher_encrypt(handle->crypt_handle, db_header, AES_BLOCK_LENGTH, NULL, 0);
     if(error)
@@ -367,50 +760,39 @@ int write_handle(db_handle_t *handle)
     }
     fwrite(db_header, AES_BLOCK_LENGTH, 1, outfile);
     
-    // Write encrypted password headers to file
-    int i;
-    char pass_header[PASS_HEADER_LENGTH];
-    for(i = 0; i < handle->num_records; i++)
+    // Write encrypted header section to file
+    error = gcry_cipher_encrypt(handle->crypt_handle, header_section, header_section_length, NULL, 0);
+    if(error)
     {
-        pass_header_t p_head = handle->pass_headers[i];
-        
-        int pass_size_offset = sizeof(p_head.name);
-        int create_time_offset = pass_size_offset + sizeof(p_head.pass_size);
-        int record_size_offset = create_time_offset + sizeof(p_head.create_time);
-        int record_start_offset = record_size_offset + sizeof(p_head.record_size);
-
-        memcpy(pass_header, p_head.name, sizeof(p_head.name));
-        memcpy(pass_header + pass_size_offset, &(p_head.pass_size), sizeof(p_head.pass_size));
-        memcpy(pass_header + create_time_offset, &(p_head.create_time), sizeof(p_head.create_time));
-        memcpy(pass_header + record_size_offset, &(p_head.record_size), sizeof(p_head.record_size));
-        memcpy(pass_header + record_start_offset, &(p_head.record_start), sizeof(p_head.record_start));
-        
-        error = gcry_cipher_encrypt(handle->crypt_handle, pass_header, PASS_HEADER_LENGTH, NULL, 0);
-        if(error)
-        {
-            printf("%s\n", gcry_strerror(error));
-            exit(EXIT_FAILURE);
-        }
-        fwrite(pass_header, PASS_HEADER_LENGTH, 1, outfile);
-    }
+        printf("%s\n", gcry_strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    fwrite(header_section, header_section_length, 1, outfile);
+    free(header_section);
     
     // Write encrypted password data to file
     fwrite(handle->pass_data, 1, handle->pass_data_size, outfile);
-    fclose(outfile);
+    if(ferror(outfile) | fclose(outfile))
+    {
+        return finish_compaction(old_starts, DB_FILE_OPEN_ERROR, handle);
+    }
     
-    return 0;
+    return finish_compaction(old_starts, 0, handle);
 }
 
 // Clean up memory from db handle
 void close_handle(db_handle_t *handle)
 {
     // Zero out decrypted password header data
-    memset(handle->pass_headers, 0, sizeof(pass_header_t) * handle->num_records);
+    free_headers(handle->pass_headers, handle->num_records);
     
     free(handle->filename);
     free(handle->salt);
     free(handle->iv);
-    free(handle->pass_headers);
+    
+    // Zero out cached encryption key
+    memset(handle->key, 0, KEY_SIZE);
+    gcry_free(handle->key);
     free(handle->pass_data);
     gcry_cipher_close(handle->crypt_handle);
 }
@@ -433,7 +815,7 @@ char * get_pass(char *name, db_handle_t *handle)
             break;
         }
     }
-    if(!isfound)
+    if(!isfound || header.record_type != RECORD_TYPE_PASS)    // Blobs are retrieved with cat_blob
     {
         return NULL;
     }
@@ -484,7 +866,14 @@ int list_records(db_handle_t *handle)
         char *create_time = ctime((time_t *) &(handle->pass_headers[i].create_time));
 
         printf("Name: %s | ", handle->pass_headers[i].name);
-        printf("%lu characters long\n", handle->pass_headers[i].pass_size);
+        if(handle->pass_headers[i].record_type == RECORD_TYPE_BLOB)
+        {
+            printf("blob, %lu bytes long\n", handle->pass_headers[i].pass_size);
+        }
+        else
+        {
+            printf("%lu characters long\n", handle->pass_headers[i].pass_size);
+        }
         printf("Created: %s\n", create_time);
     }
     printf("\n");
@@ -500,3 +889,794 @@ void print_db_info(db_handle_t *handle)
     printf("Number of Records: %u\n", handle->num_records);
     printf("Last Edited: %s\n", last_edit);
 }
+
+
+// Name of the file holding an opened database's blob chunks
+static char * blob_filename(db_handle_t *handle)
+{
+    char *filename = malloc(strlen(handle->filename) + strlen(BLOB_FILE_SUFFIX) + 1);
+    strcpy(filename, handle->filename);
+    strcat(filename, BLOB_FILE_SUFFIX);
+    return filename;
+}
+
+// Name of the file a compacted copy of the blob file is written to
+static char * blob_temp_filename(db_handle_t *handle)
+{
+    char *filename = malloc(strlen(handle->filename) + strlen(BLOB_TEMP_FILE_SUFFIX) + 1);
+    strcpy(filename, handle->filename);
+    strcat(filename, BLOB_TEMP_FILE_SUFFIX);
+    return filename;
+}
+
+// Size on disk of a chunk holding length bytes of blob data
+static uint64_t chunk_disk_length(uint64_t length)
+{
+    return IV_LENGTH + (length + AES_BLOCK_LENGTH - 1) / AES_BLOCK_LENGTH * AES_BLOCK_LENGTH;
+}
+
+// Size on disk of a blob length bytes long
+uint64_t blob_disk_length(uint64_t length)
+{
+    uint64_t disk_length = length / BLOB_CHUNK_LENGTH * chunk_disk_length(BLOB_CHUNK_LENGTH);
+    if(length % BLOB_CHUNK_LENGTH)
+    {
+        disk_length += chunk_disk_length(length % BLOB_CHUNK_LENGTH);
+    }
+    return disk_length;
+}
+
+// Read until len bytes have been read or end of file is reached
+static long read_full(int fd, char *buff, long len)
+{
+    long total = 0;
+    while(total < len)
+    {
+        long num_read = read(fd, buff + total, len - total);
+        if(num_read < 0)
+        {
+            return -1;
+        }
+        else if(num_read == 0)
+        {
+            break;
+        }
+        total += num_read;
+    }
+    return total;
+}
+
+// Write all len bytes
+static int write_full(int fd, char *buff, long len)
+{
+    while(len > 0)
+    {
+        long num_written = write(fd, buff, len);
+        if(num_written < 0)
+        {
+            return -1;
+        }
+        buff += num_written;
+        len -= num_written;
+    }
+    return 0;
+}
+
+// Add a blob record read from infd to an opened database
+// Data is encrypted and appended to the blob file one chunk at a time
+int put_blob(char *name, int infd, db_handle_t *handle)
+{
+    if(strlen(name) == 0 || strlen(name) > MAX_PASS_NAME_LENGTH)
+    {
+        return DB_BAD_RECORD_NAME;
+    }
+    else if(find_record(name, handle) != -1)
+    {
+        return DB_RECORD_EXISTS;
+    }
+    else if(handle->num_records == 1000)    // Each db can only hold 1000 records
+    {
+        return DB_RECORD_LIMIT_REACHED;
+    }
+    
+    char *filename = blob_filename(handle);
+    FILE *blob_file = fopen(filename, "ab");
+    free(filename);
+    if(!blob_file)
+    {
+        return DB_FILE_OPEN_ERROR;
+    }
+    
+    pass_header_t new_blob_header;
+    init_header(&new_blob_header, name, RECORD_TYPE_BLOB);
+    
+    fseek(blob_file, 0, SEEK_END);
+    new_blob_header.record_start = ftell(blob_file);
+    new_blob_header.pass_size = 0;
+    new_blob_header.record_size = 0;
+    
+    // Each chunk is stored as a random IV followed by the encrypted chunk
+    char *chunk = malloc(IV_LENGTH + BLOB_CHUNK_LENGTH);
+    long chunk_length;
+    int error_code = 0;
+    while((chunk_length = read_full(infd, chunk + IV_LENGTH, BLOB_CHUNK_LENGTH)) > 0)
+    {
+        uint64_t disk_length = chunk_disk_length(chunk_length);
+        memset(chunk + IV_LENGTH + chunk_length, 0, disk_length - IV_LENGTH - chunk_length);
+        
+        gcry_randomize(chunk, IV_LENGTH, GCRY_STRONG_RANDOM);
+        gcry_cipher_setiv(handle->crypt_handle, chunk, IV_LENGTH);
+        error = gcry_cipher_encrypt(handle->crypt_handle, chunk + IV_LENGTH, disk_length - IV_LENGTH, NULL, 0);
+        if(error)
+        {
+            printf("%s\n", gcry_strerror(error));
+            exit(EXIT_FAILURE);
+        }
+        
+        if(fwrite(chunk, disk_length, 1, blob_file) != 1)
+        {
+            error_code = DB_BLOB_IO_ERROR;
+            break;
+        }
+        new_blob_header.pass_size += chunk_length;
+        new_blob_header.record_size += disk_length;
+    }
+    if(chunk_length < 0)
+    {
+        error_code = DB_BLOB_IO_ERROR;
+    }
+    
+    memset(chunk, 0, IV_LENGTH + BLOB_CHUNK_LENGTH);
+    free(chunk);
+    if(fclose(blob_file) && !error_code)
+    {
+        error_code = DB_BLOB_IO_ERROR;
+    }
+    if(error_code)
+    {
+        return error_code;
+    }
+    
+    append_header(&new_blob_header, handle);
+    handle->owns_blob_file = 1;
+    return write_handle(handle);
+}
+
+// Decrypt a blob record one chunk at a time, writing its data to outfd
+// If outfd is -1 the data is only checked and then discarded
+int stream_blob(pass_header_t *header, int outfd, gcry_cipher_hd_t crypt_handle, db_handle_t *handle)
+{
+    char *filename = blob_filename(handle);
+    FILE *blob_file = fopen(filename, "rb");
+    free(filename);
+    if(!blob_file)
+    {
+        return header->pass_size ? DB_FILE_OPEN_ERROR : 0;
+    }
+    
+    char *chunk = malloc(IV_LENGTH + BLOB_CHUNK_LENGTH);
+    int error_code = 0;
+    uint64_t remaining = header->pass_size;
+    
+    if(fseek(blob_file, header->record_start, SEEK_SET))
+    {
+        error_code = DB_BLOB_IO_ERROR;
+    }
+    while(!error_code && remaining > 0)
+    {
+        uint64_t chunk_length = remaining < BLOB_CHUNK_LENGTH ? remaining : BLOB_CHUNK_LENGTH;
+        uint64_t disk_length = chunk_disk_length(chunk_length);
+        
+        if(fread(chunk, disk_length, 1, blob_file) != 1)
+        {
+            error_code = DB_BLOB_IO_ERROR;
+            break;
+        }
+        
+        gcry_cipher_setiv(crypt_handle, chunk, IV_LENGTH);
+        if(gcry_cipher_decrypt(crypt_handle, chunk + IV_LENGTH, disk_length - IV_LENGTH, NULL, 0))
+        {
+            error_code = DB_BLOB_IO_ERROR;
+            break;
+        }
+        
+        // Padding at the end of a chunk must be null
+        uint64_t i;
+        for(i = IV_LENGTH + chunk_length; i < disk_length; i++)
+        {
+            if(chunk[i] != '\0')
+            {
+                error_code = DB_BLOB_IO_ERROR;
+            }
+        }
+        
+        if(!error_code && outfd != -1 && write_full(outfd, chunk + IV_LENGTH, chunk_length))
+        {
+            error_code = DB_BLOB_IO_ERROR;
+        }
+        remaining -= chunk_length;
+    }
+    
+    memset(chunk, 0, IV_LENGTH + BLOB_CHUNK_LENGTH);
+    free(chunk);
+    fclose(blob_file);
+    return error_code;
+}
+
+// Retrieve a blob record from an opened database, writing its data to outfd
+int cat_blob(char *name, int outfd, db_handle_t *handle)
+{
+    int location;
+    if((location = find_record(name, handle)) == -1)
+    {
+        return DB_RECORD_NOT_FOUND;
+    }
+    else if(handle->pass_headers[location].record_type != RECORD_TYPE_BLOB)
+    {
+        return DB_RECORD_WRONG_TYPE;
+    }
+    
+    return stream_blob(&handle->pass_headers[location], outfd, handle->crypt_handle, handle);
+}
+
+// Check a header's record size matches the encrypted size of its password or blob
+int record_size_valid(pass_header_t *header)
+{
+    if(header->record_type == RECORD_TYPE_BLOB)
+    {
+        return header->record_size == blob_disk_length(header->pass_size);
+    }
+    return header->record_type == RECORD_TYPE_PASS && header->record_size != 0 &&
+           header->record_size == pass_block_length(header->pass_size);
+}
+
+// Check a header's record lies within data_size bytes of password or blob data
+int record_in_bounds(pass_header_t *header, uint64_t data_size)
+{
+    return header->record_start <= data_size && header->record_size <= data_size - header->record_start;
+}
+
+// Shared state for verify workers
+typedef struct verify_state
+{
+    db_handle_t *handle;
+    uint32_t *problems;
+} verify_state_t;
+
+// Decrypt one record and check it holds a readable, null padded password
+static void verify_record(uint32_t index, gcry_cipher_hd_t crypt_handle, void *arg)
+{
+    verify_state_t *state = arg;
+    pass_header_t *header = &state->handle->pass_headers[index];
+
+    // Records with bad bounds can't be safely decrypted
+    if(state->problems[index] & (VERIFY_BAD_SIZE | VERIFY_OUT_OF_BOUNDS))
+    {
+        return;
+    }
+    
+    if(header->record_type == RECORD_TYPE_BLOB)
+    {
+        if(stream_blob(header, -1, crypt_handle, state->handle))
+        {
+            state->problems[index] |= VERIFY_BAD_DATA;
+        }
+        return;
+    }
+
+    char *pass_buff = malloc(header->record_size);
+    memcpy(pass_buff, state->handle->pass_data + header->record_start, header->record_size);
+
+    gcry_cipher_setiv(crypt_handle, state->handle->iv, IV_LENGTH);
+    gcry_error_t err = gcry_cipher_decrypt(crypt_handle, pass_buff, header->record_size, NULL, 0);
+    if(err)
+    {
+        state->problems[index] |= VERIFY_BAD_DATA;
+    }
+    else
+    {
+        uint64_t i;
+        for(i = 0; i < header->record_size; i++)
+        {
+            int readable = pass_buff[i] >= ' ' && pass_buff[i] <= '~';
+            if((i < header->pass_size && !readable) || (i >= header->pass_size && pass_buff[i] != '\0'))
+            {
+                state->problems[index] |= VERIFY_BAD_DATA;
+                break;
+            }
+        }
+    }
+
+    memset(pass_buff, 0, header->record_size);
+    free(pass_buff);
+}
+
+// Record index paired with the header field it is sorted by, so comparisons need no other state
+typedef struct sort_entry
+{
+    uint64_t key;
+    char *name;
+    uint32_t index;
+} sort_entry_t;
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(((sort_entry_t *) a)->name, ((sort_entry_t *) b)->name);
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    uint64_t key_a = ((sort_entry_t *) a)->key;
+    uint64_t key_b = ((sort_entry_t *) b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+// Sort count record indices by name, record start or create time (SORT_BY_*)
+static void sort_records(uint32_t *indices, uint32_t count, int field, db_handle_t *handle)
+{
+    sort_entry_t *entries = malloc(sizeof(sort_entry_t) * (count + 1));
+    uint32_t i;
+    for(i = 0; i < count; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[indices[i]];
+        entries[i].key = field == SORT_BY_START ? header->record_start : header->create_time;
+        entries[i].name = header->name;
+        entries[i].index = indices[i];
+    }
+
+    qsort(entries, count, sizeof(sort_entry_t), field == SORT_BY_NAME ? compare_names : compare_keys);
+
+    for(i = 0; i < count; i++)
+    {
+        indices[i] = entries[i].index;
+    }
+    free(entries);
+}
+
+// Copy the chunks referenced by blob records into a new blob file and move blob headers
+// to their offsets in it. The old blob file stays in place until finish_compaction runs
+// after the headers are written. Does nothing unless this database's blob file holds
+// data no record refers to, otherwise *old_starts is set to every record's previous start
+static int compact_blobs(uint64_t **old_starts, db_handle_t *handle)
+{
+    *old_starts = NULL;
+
+    // Never touch a blob file this database hasn't used
+    char *filename = blob_filename(handle);
+    struct stat blob_stat;
+    if(!handle->owns_blob_file || stat(filename, &blob_stat))
+    {
+        free(filename);
+        return 0;
+    }
+
+    uint32_t *order = malloc(sizeof(uint32_t) * (handle->num_records + 1));
+    uint32_t num_blobs = 0;
+    uint64_t live_size = 0;
+    uint32_t i;
+    for(i = 0; i < handle->num_records; i++)
+    {
+        if(handle->pass_headers[i].record_type == RECORD_TYPE_BLOB)
+        {
+            order[num_blobs++] = i;
+            live_size += handle->pass_headers[i].record_size;
+        }
+    }
+
+    if(live_size == (uint64_t) blob_stat.st_size)
+    {
+        free(order);
+        free(filename);
+        return 0;
+    }
+
+    // Copy live chunks in file order into a new blob file, one chunk at a time
+    // With no blobs left nothing is copied and the blob file is removed later
+    sort_records(order, num_blobs, SORT_BY_START, handle);
+
+    char *temp_filename = blob_temp_filename(handle);
+    FILE *infile = NULL;
+    FILE *outfile = NULL;
+    int error_code = 0;
+    if(num_blobs > 0)
+    {
+        infile = fopen(filename, "rb");
+        outfile = fopen(temp_filename, "wb");
+        if(!infile || !outfile)
+        {
+            error_code = DB_BLOB_IO_ERROR;
+        }
+    }
+
+    uint64_t *new_starts = malloc(sizeof(uint64_t) * (num_blobs + 1));
+    char *buff = malloc(BLOB_CHUNK_LENGTH);
+    uint64_t new_start = 0;
+    for(i = 0; !error_code && i < num_blobs; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[order[i]];
+        new_starts[i] = new_start;
+        new_start += header->record_size;
+
+        if(fseek(infile, header->record_start, SEEK_SET))
+        {
+            error_code = DB_BLOB_IO_ERROR;
+        }
+
+        uint64_t remaining = header->record_size;
+        while(!error_code && remaining > 0)
+        {
+            uint64_t length = remaining < BLOB_CHUNK_LENGTH ? remaining : BLOB_CHUNK_LENGTH;
+            if(fread(buff, length, 1, infile) != 1 || fwrite(buff, length, 1, outfile) != 1)
+            {
+                error_code = DB_BLOB_IO_ERROR;
+            }
+            remaining -= length;
+        }
+    }
+
+    if(infile)
+    {
+        fclose(infile);
+    }
+    if(outfile && fclose(outfile) && !error_code)
+    {
+        error_code = DB_BLOB_IO_ERROR;
+    }
+
+    if(error_code)
+    {
+        remove(temp_filename);
+    }
+    else
+    {
+        *old_starts = malloc(sizeof(uint64_t) * (handle->num_records + 1));
+        for(i = 0; i < handle->num_records; i++)
+        {
+            (*old_starts)[i] = handle->pass_headers[i].record_start;
+        }
+        for(i = 0; i < num_blobs; i++)
+        {
+            handle->pass_headers[order[i]].record_start = new_starts[i];
+        }
+    }
+
+    free(buff);
+    free(new_starts);
+    free(temp_filename);
+    free(order);
+    free(filename);
+    return error_code;
+}
+
+// Finish a compaction started by compact_blobs once the database write is done
+// If the write succeeded the compacted blob file replaces the old one, otherwise it is
+// discarded and blob headers move back to their old offsets
+static int finish_compaction(uint64_t *old_starts, int error_code, db_handle_t *handle)
+{
+    if(!old_starts)
+    {
+        return error_code;
+    }
+
+    char *filename = blob_filename(handle);
+    char *temp_filename = blob_temp_filename(handle);
+    uint32_t num_blobs = 0;
+    uint32_t i;
+    for(i = 0; i < handle->num_records; i++)
+    {
+        num_blobs += handle->pass_headers[i].record_type == RECORD_TYPE_BLOB;
+    }
+
+    if(error_code)
+    {
+        for(i = 0; i < handle->num_records; i++)
+        {
+            handle->pass_headers[i].record_start = old_starts[i];
+        }
+        remove(temp_filename);
+    }
+    else if(num_blobs == 0 ? remove(filename) : rename(temp_filename, filename))
+    {
+        // Headers on disk already point into the compacted file, so it is left for
+        // recover_compaction to move into place when the database is next opened
+        error_code = DB_BLOB_IO_ERROR;
+    }
+
+    free(old_starts);
+    free(temp_filename);
+    free(filename);
+    return error_code;
+}
+
+// Complete or discard a compaction interrupted between writing the database and
+// replacing the blob file. The compacted file is only moved into place if the headers
+// on disk describe its layout: every blob back to back from the start of the file
+static int recover_compaction(db_handle_t *handle)
+{
+    char *temp_filename = blob_temp_filename(handle);
+    struct stat temp_stat;
+    if(!handle->owns_blob_file || stat(temp_filename, &temp_stat))
+    {
+        free(temp_filename);
+        return 0;
+    }
+
+    uint32_t *order = malloc(sizeof(uint32_t) * (handle->num_records + 1));
+    uint32_t num_blobs = 0;
+    uint32_t i;
+    for(i = 0; i < handle->num_records; i++)
+    {
+        if(handle->pass_headers[i].record_type == RECORD_TYPE_BLOB)
+        {
+            order[num_blobs++] = i;
+        }
+    }
+    sort_records(order, num_blobs, SORT_BY_START, handle);
+
+    uint64_t end = 0;
+    for(i = 0; i < num_blobs && handle->pass_headers[order[i]].record_start == end; i++)
+    {
+        end += handle->pass_headers[order[i]].record_size;
+    }
+
+    int error_code = 0;
+    if(i == num_blobs && end == (uint64_t) temp_stat.st_size)
+    {
+        char *filename = blob_filename(handle);
+        if(rename(temp_filename, filename))
+        {
+            error_code = DB_BLOB_IO_ERROR;
+        }
+        free(filename);
+    }
+    else
+    {
+        remove(temp_filename);
+    }
+
+    free(order);
+    free(temp_filename);
+    return error_code;
+}
+
+// Mark overlapping records of one type and return how many bytes of their data they cover
+// order must hold every record index sorted by record start
+static uint64_t check_coverage(db_handle_t *handle, uint32_t *order, uint32_t *problems, uint32_t record_type)
+{
+    uint64_t covered = 0;
+    uint64_t covered_end = 0;
+    int64_t last = -1;
+    uint32_t i;
+    for(i = 0; i < handle->num_records; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[order[i]];
+        if(header->record_type != record_type || problems[order[i]] & VERIFY_OUT_OF_BOUNDS)
+        {
+            continue;
+        }
+
+        uint64_t record_end = header->record_start + header->record_size;
+        if(last != -1 && header->record_start < covered_end)
+        {
+            problems[order[i]] |= VERIFY_OVERLAP;
+            problems[last] |= VERIFY_OVERLAP;
+        }
+        if(record_end > covered_end)
+        {
+            covered += record_end - (header->record_start > covered_end ? header->record_start : covered_end);
+            covered_end = record_end;
+            last = order[i];
+        }
+    }
+    return covered;
+}
+
+// Check header/data consistency of an opened database and decrypt every record
+// Prints a report of corrupt records and returns DB_VERIFY_FAILED if any were found
+int verify_db(db_handle_t *handle)
+{
+    uint32_t num_records = handle->num_records;
+    uint64_t data_size = handle->pass_data_size;
+    uint32_t *problems = calloc(num_records + 1, sizeof(uint32_t));
+    uint32_t *order = malloc(sizeof(uint32_t) * (num_records + 1));
+    
+    // Blob records are checked against the size of the blob file
+    struct stat blob_stat;
+    char *filename = blob_filename(handle);
+    uint64_t blob_size = stat(filename, &blob_stat) ? 0 : blob_stat.st_size;
+    free(filename);
+
+    // Check each header on its own
+    uint32_t i;
+    for(i = 0; i < num_records; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[i];
+
+        if(header->name[0] == '\0' || strlen(header->name) > MAX_PASS_NAME_LENGTH)
+        {
+            problems[i] |= VERIFY_BAD_NAME;
+        }
+        if(!record_size_valid(header))
+        {
+            problems[i] |= VERIFY_BAD_SIZE;
+        }
+        if(!record_in_bounds(header, header->record_type == RECORD_TYPE_BLOB ? blob_size : data_size))
+        {
+            problems[i] |= VERIFY_OUT_OF_BOUNDS;
+        }
+        order[i] = i;
+    }
+
+    // Names must be unique
+    sort_records(order, num_records, SORT_BY_NAME, handle);
+    for(i = 1; i < num_records; i++)
+    {
+        if(strcmp(handle->pass_headers[order[i - 1]].name, handle->pass_headers[order[i]].name) == 0)
+        {
+            problems[order[i - 1]] |= VERIFY_DUPLICATE_NAME;
+            problems[order[i]] |= VERIFY_DUPLICATE_NAME;
+        }
+    }
+
+    // Records must not overlap, and together they must account for all password and blob data
+    sort_records(order, num_records, SORT_BY_START, handle);
+    uint64_t unaccounted = data_size - check_coverage(handle, order, problems, RECORD_TYPE_PASS);
+    uint64_t blob_unaccounted = blob_size - check_coverage(handle, order, problems, RECORD_TYPE_BLOB);
+
+    // Decrypt and check every record across all cores
+    verify_state_t state;
+    state.handle = handle;
+    state.problems = problems;
+    run_record_pool(handle, verify_record, &state);
+
+    // Report corrupt records
+    uint32_t num_corrupt = 0;
+    printf("\n");
+    for(i = 0; i < num_records; i++)
+    {
+        if(!problems[i])
+        {
+            continue;
+        }
+        num_corrupt++;
+
+        printf("Record %u (%s):", i, handle->pass_headers[i].name);
+        if(problems[i] & VERIFY_BAD_NAME)
+        {
+            printf(" bad name;");
+        }
+        if(problems[i] & VERIFY_DUPLICATE_NAME)
+        {
+            printf(" duplicate name;");
+        }
+        if(problems[i] & VERIFY_BAD_SIZE)
+        {
+            printf(" record size doesn't match password size;");
+        }
+        if(problems[i] & VERIFY_OUT_OF_BOUNDS)
+        {
+            printf(" record outside of password or blob data;");
+        }
+        if(problems[i] & VERIFY_OVERLAP)
+        {
+            printf(" overlaps another record;");
+        }
+        if(problems[i] & VERIFY_BAD_DATA)
+        {
+            printf(" corrupted password data;");
+        }
+        printf("\n");
+    }
+
+    printf("\nRecords Checked: %u\n", num_records);
+    printf("Corrupt Records: %u\n", num_corrupt);
+    printf("Password Data: %lu bytes (%lu unaccounted for)\n", (unsigned long) data_size, (unsigned long) unaccounted);
+    printf("Blob Data: %lu bytes (%lu unaccounted for)\n", (unsigned long) blob_size, (unsigned long) blob_unaccounted);
+    printf("Worker Threads: %d\n\n", pool_size(num_records));
+
+    free(problems);
+    free(order);
+
+    if(num_corrupt || unaccounted || blob_unaccounted)
+    {
+        return DB_VERIFY_FAILED;
+    }
+    return 0;
+}
+
+// Build an index of an opened database's records ordered by creation time (oldest first)
+uint32_t * create_time_index(db_handle_t *handle)
+{
+    uint32_t *index = malloc(sizeof(uint32_t) * (handle->num_records + 1));
+    uint32_t i;
+    for(i = 0; i < handle->num_records; i++)
+    {
+        index[i] = i;
+    }
+    
+    sort_records(index, handle->num_records, SORT_BY_CREATE_TIME, handle);
+    return index;
+}
+
+// Regenerate every password created before cutoff, keeping each password's length
+// New passwords are generated in one pass and the database is written once
+int rotate_records(uint64_t cutoff, uint32_t *num_rotated, db_handle_t *handle)
+{
+    uint32_t *index = create_time_index(handle);
+    
+    // Binary search for the first record created at or after cutoff
+    uint32_t low = 0;
+    uint32_t high = handle->num_records;
+    while(low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if(handle->pass_headers[index[mid]].create_time < cutoff)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    
+    // Blobs aren't generated so they are never rotated
+    uint32_t i;
+    *num_rotated = 0;
+    for(i = 0; i < low; i++)
+    {
+        if(handle->pass_headers[index[i]].record_type == RECORD_TYPE_PASS)
+        {
+            index[(*num_rotated)++] = index[i];
+        }
+    }
+    if(*num_rotated == 0)
+    {
+        free(index);
+        return 0;
+    }
+    
+    // New blocks are written over the old ones, so each record must be exactly one block
+    uint64_t *lengths = malloc(sizeof(uint64_t) * *num_rotated);
+    for(i = 0; i < *num_rotated; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[index[i]];
+        if(!record_size_valid(header) || !record_in_bounds(header, handle->pass_data_size))
+        {
+            free(lengths);
+            free(index);
+            return DB_VERIFY_FAILED;
+        }
+        lengths[i] = header->pass_size;
+    }
+    
+    unsigned char *password_blocks;
+    uint64_t total_length = generate_passes(&password_blocks, lengths, *num_rotated);
+    
+    uint64_t now = time(NULL);
+    uint64_t offset = 0;
+    for(i = 0; i < *num_rotated; i++)
+    {
+        pass_header_t *header = &handle->pass_headers[index[i]];
+        
+        // Re-initialize iv so password encryption is consistent
+        gcry_cipher_setiv(handle->crypt_handle, handle->iv, IV_LENGTH);
+        error = gcry_cipher_encrypt(handle->crypt_handle, password_blocks + offset, header->record_size, NULL, 0);
+        if(error)
+        {
+            printf("%s\n", gcry_strerror(error));
+            exit(EXIT_FAILURE);
+        }
+        
+        memcpy(handle->pass_data + header->record_start, password_blocks + offset, header->record_size);
+        header->create_time = now;
+        offset += header->record_size;
+    }
+    
+    memset(password_blocks, 0, total_length);
+    free(password_blocks);
+    free(lengths);
+    free(index);
+    
+    return write_handle(handle);
+}
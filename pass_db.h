@@ -3,6 +3,7 @@
 
 #include <gcrypt.h>
 #include <stdint.h>
+#include <stdio.h>
 
 // Global variable for error codes
 
@@ -12,7 +13,8 @@ gcry_error_t error;
 
 typedef struct pass_header
 {
-    char name[32];
+    char *name;
+    uint32_t record_type;
     uint64_t pass_size;
     uint64_t create_time;
     uint64_t record_size;
@@ -29,10 +31,14 @@ typedef struct db_handle
     
     char *salt;
     char *iv;
+    char *key;
     
     pass_header_t *pass_headers;
     char *pass_data;
-    long pass_data_size;
+    uint64_t pass_data_size;
+    
+    // Set once the database has had blob records, so a blob file it didn't create is left alone
+    int owns_blob_file;
     
     gcry_cipher_hd_t crypt_handle;
 } db_handle_t;
@@ -40,19 +46,36 @@ typedef struct db_handle
 void init_gcrypt();
 
 char * generate_key(char *password, char *salt);
+uint64_t pass_block_length(uint64_t length);
 int generate_pass(unsigned char **pass_buff, int length);
+uint64_t generate_passes(unsigned char **pass_buff, uint64_t *lengths, uint32_t count);
 
 int create_pass_db(char *filename, char *password, db_handle_t *handle);
 int open_pass_db(char *infilename, char *password, db_handle_t *handle);
+int read_headers(FILE *infile, long file_size, db_handle_t *handle, uint32_t *num_records, uint64_t *last_edit, pass_header_t **pass_headers);
 
 int create_db_record(char *name, int size, db_handle_t *handle);
 int delete_db_record(char *name, db_handle_t *handle);
+int add_db_record(char *name, int pass_size, db_handle_t *handle);
+int remove_db_record(char *name, db_handle_t *handle);
 
 int write_handle(db_handle_t *handle);
 void close_handle(db_handle_t *handle);
+void free_headers(pass_header_t *pass_headers, uint32_t num_records);
 
 char * get_pass(char *name, db_handle_t *handle);
 int find_record(char *name, db_handle_t *handle);
 int list_records(db_handle_t *handle);
 
+uint64_t blob_disk_length(uint64_t length);
+int put_blob(char *name, int infd, db_handle_t *handle);
+int cat_blob(char *name, int outfd, db_handle_t *handle);
+int stream_blob(pass_header_t *header, int outfd, gcry_cipher_hd_t crypt_handle, db_handle_t *handle);
+int record_size_valid(pass_header_t *header);
+int record_in_bounds(pass_header_t *header, uint64_t data_size);
+int verify_db(db_handle_t *handle);
+
+uint32_t * create_time_index(db_handle_t *handle);
+int rotate_records(uint64_t cutoff, uint32_t *num_rotated, db_handle_t *handle);
+
 #endif
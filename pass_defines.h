@@ -8,17 +8,72 @@
 // Input definitions
 #define MAX_INPUT_LENGTH 1024
 #define MAX_PASS_LENGTH 33
-#define MAX_PASS_NAME_LENGTH 33
+#define MAX_PASS_NAME_LENGTH 255
 #define MAX_INT_INPUT_LENGTH 7
+#define MAX_GEN_PASS_LENGTH 10000
 
 // Database definitions
 #define KEY_SIZE 32
 #define SALT_LENGTH 32
 #define IV_LENGTH 16
 #define AES_BLOCK_LENGTH 16
-#define MAGIC_DB_CONSTANT 0xD00DBABE
+#define MAGIC_DB_CONSTANT 0xD00DBABF
 #define DB_HEADER_LENGTH 16
-#define PASS_HEADER_LENGTH 64
+
+// Password headers are stored in one varint encoded header section
+// followed by a string table holding the record names
+#define HEADER_FIELD_COUNT 6
+
+// Databases written before the header section was varint encoded
+// use fixed size password headers with a 32 byte name field, and mark
+// blob records with the top bit of the password size
+#define LEGACY_MAGIC_DB_CONSTANT 0xD00DBABE
+#define LEGACY_PASS_HEADER_LENGTH 64
+#define LEGACY_NAME_LENGTH 32
+#define BLOB_RECORD_FLAG (1ULL << 63)
+
+// Blob definitions
+// Blobs are stored in <database>.blob as independently encrypted chunks,
+// each prefixed with its own IV
+#define BLOB_FILE_SUFFIX ".blob"
+#define BLOB_TEMP_FILE_SUFFIX ".blob.tmp"
+#define BLOB_CHUNK_LENGTH 65536
+
+// Record types
+#define RECORD_TYPE_PASS 0
+#define RECORD_TYPE_BLOB 1
+
+// Problems reported per record by verify
+#define VERIFY_BAD_NAME 0x01
+#define VERIFY_DUPLICATE_NAME 0x02
+#define VERIFY_BAD_SIZE 0x04
+#define VERIFY_OUT_OF_BOUNDS 0x08
+#define VERIFY_OVERLAP 0x10
+#define VERIFY_BAD_DATA 0x20
+
+// Header fields record indices can be sorted by
+#define SORT_BY_NAME 0
+#define SORT_BY_START 1
+#define SORT_BY_CREATE_TIME 2
+
+// Events published by a database watch
+#define WATCH_RECORD_ADDED 1
+#define WATCH_RECORD_REMOVED 2
+#define WATCH_RECORD_CHANGED 3
+#define WATCH_DB_ERROR 4
+
+// Audit policy
+#define AUDIT_MIN_PASS_LENGTH 12
+#define AUDIT_MIN_ENTROPY_BITS 60
+#define AUDIT_DEFAULT_MAX_AGE (90 * 24 * 60 * 60)
+#define AUDIT_DIGEST_LENGTH 32
+
+// Problems reported per record by audit
+#define AUDIT_UNREADABLE 0x01
+#define AUDIT_DUPLICATE 0x02
+#define AUDIT_TOO_SHORT 0x04
+#define AUDIT_LOW_ENTROPY 0x08
+#define AUDIT_EXPIRED 0x10
 
 /* --- Error code definitions --- */
 
@@ -27,6 +82,7 @@
 #define DB_BAD_FILE_SIZE 2
 #define DB_BAD_MAGIC 3
 #define DB_FILE_OPEN_ERROR 4
+#define DB_BAD_HEADER 14
 
 // Editing database
 #define DB_FILE_EXISTS 5
@@ -34,5 +90,22 @@
 #define DB_RECORD_NOT_FOUND 7
 #define DB_NO_RECORDS 8
 #define DB_RECORD_LIMIT_REACHED 9
+#define DB_RECORD_WRONG_TYPE 11
+#define DB_BLOB_IO_ERROR 12
+#define DB_BAD_RECORD_NAME 15
+#define DB_BAD_PASS_LENGTH 18
+
+// Verifying database
+#define DB_VERIFY_FAILED 10
+
+// Auditing database
+#define DB_AUDIT_FAILED 16
+
+// Watching database
+#define DB_WATCH_ERROR 13
+
+// Running batch commands
+#define DB_BAD_COMMAND 17
+#define DB_LINE_TOO_LONG 19
 
 #endif
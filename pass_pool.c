@@ -0,0 +1,99 @@
+#include "pass_pool.h"
+#include "pass_defines.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// State shared between all workers of one pool run
+typedef struct pool_state
+{
+    db_handle_t *handle;
+    pool_job_t job;
+    void *arg;
+    uint32_t next_index;
+} pool_state_t;
+
+// Number of worker threads to use for num_jobs jobs (one per online core)
+int pool_size(uint32_t num_jobs)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1)
+    {
+        cores = 1;
+    }
+    if(cores > num_jobs)
+    {
+        cores = num_jobs;
+    }
+    return (int) cores;
+}
+
+// Worker loop: claim the next unprocessed record index until none are left
+static void * pool_worker(void *arg)
+{
+    pool_state_t *state = arg;
+    gcry_cipher_hd_t crypt_handle;
+
+    gcry_error_t err = gcry_cipher_open(&crypt_handle, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CBC, 0);
+    if(!err)
+    {
+        err = gcry_cipher_setkey(crypt_handle, state->handle->key, KEY_SIZE);
+    }
+    if(err)
+    {
+        printf("%s\n", gcry_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t index;
+    while((index = __sync_fetch_and_add(&state->next_index, 1)) < state->handle->num_records)
+    {
+        state->job(index, crypt_handle, state->arg);
+    }
+
+    gcry_cipher_close(crypt_handle);
+    return NULL;
+}
+
+// Run job over every record in an opened database using all available cores
+int run_record_pool(db_handle_t *handle, pool_job_t job, void *arg)
+{
+    if(handle->num_records == 0)
+    {
+        return 0;
+    }
+
+    pool_state_t state;
+    state.handle = handle;
+    state.job = job;
+    state.arg = arg;
+    state.next_index = 0;
+
+    int num_threads = pool_size(handle->num_records);
+    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+
+    // Fall back to running on the calling thread if no workers could be started
+    int started = 0;
+    int i;
+    for(i = 0; i < num_threads; i++)
+    {
+        if(pthread_create(&threads[i], NULL, pool_worker, &state))
+        {
+            break;
+        }
+        started++;
+    }
+    if(started == 0)
+    {
+        pool_worker(&state);
+    }
+
+    for(i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef PASS_POOL_H
+#define PASS_POOL_H
+
+#include "pass_db.h"
+
+// Job run once for every record index in a database. Each worker thread
+// owns its own cipher handle keyed from the database key, so jobs may
+// decrypt records without locking.
+
+typedef void (*pool_job_t)(uint32_t index, gcry_cipher_hd_t crypt_handle, void *arg);
+
+int pool_size(uint32_t num_jobs);
+int run_record_pool(db_handle_t *handle, pool_job_t job, void *arg);
+
+#endif
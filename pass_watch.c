@@ -0,0 +1,283 @@
+#include "pass_watch.h"
+#include "pass_defines.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/inotify.h>
+
+// Start watching the file of an opened database for changes made by other writers
+// The database's directory is watched so files replaced by a rename are seen too
+int watch_db(db_watch_t *watch, db_handle_t *handle)
+{
+    watch->handle = handle;
+    watch->subscribers = NULL;
+    watch->num_subscribers = 0;
+
+    // Split filename into directory and base name
+    char *slash = strrchr(handle->filename, '/');
+    char *dirname;
+    if(slash)
+    {
+        int dir_length = slash == handle->filename ? 1 : slash - handle->filename;
+        dirname = malloc(dir_length + 1);
+        memcpy(dirname, handle->filename, dir_length);
+        dirname[dir_length] = '\0';
+
+        watch->basename = malloc(strlen(slash + 1) + 1);
+        strcpy(watch->basename, slash + 1);
+    }
+    else
+    {
+        dirname = malloc(2);
+        strcpy(dirname, ".");
+
+        watch->basename = malloc(strlen(handle->filename) + 1);
+        strcpy(watch->basename, handle->filename);
+    }
+
+    watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(watch->inotify_fd == -1 || inotify_add_watch(watch->inotify_fd, dirname, IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+    {
+        if(watch->inotify_fd != -1)
+        {
+            close(watch->inotify_fd);
+        }
+        free(dirname);
+        free(watch->basename);
+        return DB_WATCH_ERROR;
+    }
+
+    free(dirname);
+    return 0;
+}
+
+// Register a callback to be run for every change found by a watch
+int subscribe_watch(db_watch_t *watch, watch_callback_t callback, void *arg)
+{
+    watch_subscriber_t *new_subscribers = malloc(sizeof(watch_subscriber_t) * (watch->num_subscribers + 1));
+    memcpy(new_subscribers, watch->subscribers, sizeof(watch_subscriber_t) * watch->num_subscribers);
+
+    free(watch->subscribers);
+    watch->subscribers = new_subscribers;
+
+    watch->subscribers[watch->num_subscribers].callback = callback;
+    watch->subscribers[watch->num_subscribers].arg = arg;
+    watch->num_subscribers++;
+
+    return 0;
+}
+
+// Send an event to every subscriber of a watch
+static void publish_event(db_watch_t *watch, int type, pass_header_t *header, int error_code)
+{
+    watch_event_t event;
+    event.type = type;
+    event.header = header;
+    event.error_code = error_code;
+
+    int i;
+    for(i = 0; i < watch->num_subscribers; i++)
+    {
+        watch->subscribers[i].callback(&event, watch->handle, watch->subscribers[i].arg);
+    }
+}
+
+// Wait up to timeout milliseconds (-1 waits forever) for the database file to change
+// and reload the handle if it did
+int poll_watch(db_watch_t *watch, int timeout)
+{
+    struct pollfd poll_fd;
+    poll_fd.fd = watch->inotify_fd;
+    poll_fd.events = POLLIN;
+
+    int ready = poll(&poll_fd, 1, timeout);
+    if(ready == -1)
+    {
+        return DB_WATCH_ERROR;
+    }
+    else if(ready == 0)
+    {
+        return 0;
+    }
+
+    // Drain every queued event so a burst of writes causes a single reload
+    char events[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    int removed = 0;
+    long length;
+    while((length = read(watch->inotify_fd, events, sizeof(events))) > 0)
+    {
+        char *ptr;
+        for(ptr = events; ptr < events + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event *) ptr)->len)
+        {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            if(event->mask & IN_Q_OVERFLOW)
+            {
+                // Events were dropped, so any of them could have been a change to the database
+                changed = 1;
+            }
+            else if(event->mask & IN_IGNORED)
+            {
+                // The directory is gone or no longer watched, so no more events will arrive
+                removed = 1;
+            }
+            else if(event->len && strcmp(event->name, watch->basename) == 0)
+            {
+                changed = 1;
+            }
+        }
+    }
+
+    if(removed)
+    {
+        return DB_WATCH_ERROR;
+    }
+    return changed ? reload_handle(watch) : 0;
+}
+
+// Reload an opened database from its file using the cached key
+// Headers are decrypted again, but record data stays encrypted and is only compared
+// against the previous contents to find which records changed
+int reload_handle(db_watch_t *watch)
+{
+    db_handle_t *handle = watch->handle;
+    int error_code = 0;
+
+    FILE *infile = fopen(handle->filename, "rb");
+    if(!infile)
+    {
+        publish_event(watch, WATCH_DB_ERROR, NULL, DB_FILE_OPEN_ERROR);
+        return DB_FILE_OPEN_ERROR;
+    }
+
+    fseek(infile, 0, SEEK_END);
+    long file_size = ftell(infile);
+    rewind(infile);
+
+    // Cached key is only valid if the salt and IV haven't changed
+    char salt[SALT_LENGTH];
+    char iv[IV_LENGTH];
+    if(file_size % AES_BLOCK_LENGTH || fread(salt, SALT_LENGTH, 1, infile) != 1 || fread(iv, IV_LENGTH, 1, infile) != 1)
+    {
+        error_code = DB_BAD_FILE_SIZE;
+    }
+    else if(memcmp(salt, handle->salt, SALT_LENGTH) || memcmp(iv, handle->iv, IV_LENGTH))
+    {
+        error_code = DB_BAD_MAGIC;
+    }
+
+    uint32_t num_records;
+    uint64_t last_edit;
+    pass_header_t *pass_headers = NULL;
+    if(!error_code)
+    {
+        error_code = read_headers(infile, file_size, handle, &num_records, &last_edit, &pass_headers);
+    }
+
+    char *pass_data = NULL;
+    uint64_t pass_data_size = 0;
+    if(!error_code && num_records > 0)
+    {
+        pass_data_size = file_size - ftell(infile);
+        pass_data = malloc(pass_data_size);
+        if(pass_data_size && fread(pass_data, pass_data_size, 1, infile) != 1)
+        {
+            error_code = DB_BAD_FILE_SIZE;
+            free(pass_data);
+            free_headers(pass_headers, num_records);
+        }
+    }
+    fclose(infile);
+
+    if(error_code)
+    {
+        publish_event(watch, WATCH_DB_ERROR, NULL, error_code);
+        return error_code;
+    }
+
+    // Swap new state into handle, keeping old state until events are published
+    uint32_t old_num_records = handle->num_records;
+    pass_header_t *old_headers = handle->pass_headers;
+    char *old_data = handle->pass_data;
+    uint64_t old_data_size = handle->pass_data_size;
+
+    handle->num_records = num_records;
+    handle->last_edit = last_edit;
+    handle->pass_headers = pass_headers;
+    handle->pass_data = pass_data;
+    handle->pass_data_size = pass_data_size;
+
+    // Find added and changed records
+    uint32_t i, j;
+    for(i = 0; i < num_records; i++)
+    {
+        pass_header_t *header = &pass_headers[i];
+        pass_header_t *old_header = NULL;
+        for(j = 0; j < old_num_records; j++)
+        {
+            if(strcmp(header->name, old_headers[j].name) == 0)
+            {
+                old_header = &old_headers[j];
+                break;
+            }
+        }
+
+        if(!old_header)
+        {
+            publish_event(watch, WATCH_RECORD_ADDED, header, 0);
+            continue;
+        }
+
+        int changed = header->record_type != old_header->record_type ||
+                      header->pass_size != old_header->pass_size ||
+                      header->create_time != old_header->create_time ||
+                      header->record_size != old_header->record_size;
+
+        // Blob chunks move when the blob file is compacted, so blobs are compared by header only
+        if(!changed && header->record_type == RECORD_TYPE_PASS)
+        {
+            changed = !record_in_bounds(header, pass_data_size) || !record_in_bounds(old_header, old_data_size) ||
+                      memcmp(pass_data + header->record_start, old_data + old_header->record_start, header->record_size);
+        }
+
+        if(changed)
+        {
+            publish_event(watch, WATCH_RECORD_CHANGED, header, 0);
+        }
+    }
+
+    // Find removed records
+    for(j = 0; j < old_num_records; j++)
+    {
+        int found = 0;
+        for(i = 0; i < num_records; i++)
+        {
+            if(strcmp(pass_headers[i].name, old_headers[j].name) == 0)
+            {
+                found = 1;
+                break;
+            }
+        }
+
+        if(!found)
+        {
+            publish_event(watch, WATCH_RECORD_REMOVED, &old_headers[j], 0);
+        }
+    }
+
+    // Zero out old decrypted password header data
+    free_headers(old_headers, old_num_records);
+    free(old_data);
+
+    return 0;
+}
+
+// Stop watching a database and clean up memory from watch
+void close_watch(db_watch_t *watch)
+{
+    close(watch->inotify_fd);
+    free(watch->basename);
+    free(watch->subscribers);
+}
@@ -0,0 +1,43 @@
+#ifndef PASS_WATCH_H
+#define PASS_WATCH_H
+
+#include "pass_db.h"
+
+// Change published to watch subscribers
+// header points to the record's new header (or its old header when removed)
+// and is NULL for WATCH_DB_ERROR events
+
+typedef struct watch_event
+{
+    int type;
+    pass_header_t *header;
+    int error_code;
+} watch_event_t;
+
+typedef void (*watch_callback_t)(watch_event_t *event, db_handle_t *handle, void *arg);
+
+typedef struct watch_subscriber
+{
+    watch_callback_t callback;
+    void *arg;
+} watch_subscriber_t;
+
+// Struct to hold state of a watch on an opened database's file
+
+typedef struct db_watch
+{
+    db_handle_t *handle;
+    int inotify_fd;
+    char *basename;
+    
+    watch_subscriber_t *subscribers;
+    int num_subscribers;
+} db_watch_t;
+
+int watch_db(db_watch_t *watch, db_handle_t *handle);
+int subscribe_watch(db_watch_t *watch, watch_callback_t callback, void *arg);
+int poll_watch(db_watch_t *watch, int timeout);
+int reload_handle(db_watch_t *watch);
+void close_watch(db_watch_t *watch);
+
+#endif